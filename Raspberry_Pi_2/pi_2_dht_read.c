@@ -28,16 +28,22 @@
 #include "pi_2_dht_read.h"
 #include "pi_2_mmio.h"
 
-// This is the only processor specific magic value, the maximum amount of time to
-// spin in a loop before bailing out and considering the read a timeout.  This should
-// be a high value, but if you're running on a much faster platform than a Raspberry
-// Pi or Beaglebone Black then it might need to be increased.
-#define DHT_MAXCOUNT 32000
-
-// Number of bit pulses to expect from the DHT.  Note that this is 41 because
-// the first pulse is a constant 50 microsecond pulse, with 40 pulses to represent
-// the data afterwards.
-#define DHT_PULSES 41
+// When built for a single GPIO ('make PIN=...'), use the accessors with
+// constant register offsets and masks for it: the tightest polling loops
+// below are then just a load, an AND and a branch.
+#ifdef PI_2_MMIO_FIXED_GPIO
+#define DHT_SET_OUTPUT(pin)  pi_2_mmio_fixed_set_output()
+#define DHT_SET_INPUT(pin)   pi_2_mmio_fixed_set_input()
+#define DHT_SET_HIGH(pin)    pi_2_mmio_fixed_set_high()
+#define DHT_SET_LOW(pin)     pi_2_mmio_fixed_set_low()
+#define DHT_INPUT(pin)       pi_2_mmio_fixed_input()
+#else
+#define DHT_SET_OUTPUT(pin)  pi_2_mmio_set_output(pin)
+#define DHT_SET_INPUT(pin)   pi_2_mmio_set_input(pin)
+#define DHT_SET_HIGH(pin)    pi_2_mmio_set_high(pin)
+#define DHT_SET_LOW(pin)     pi_2_mmio_set_low(pin)
+#define DHT_INPUT(pin)       pi_2_mmio_input(pin)
+#endif
 
 int pi_2_dht_read(int type, int pin, float* humidity, float* temperature) {
   // Validate humidity and temperature arguments and set them to zero.
@@ -47,41 +53,55 @@ int pi_2_dht_read(int type, int pin, float* humidity, float* temperature) {
   *temperature = 0.0f;
   *humidity = 0.0f;
 
+  // Store the count that each DHT bit pulse is low and high.
+  // Make sure array is initialized to start at zero.
+  int pulseCounts[DHT_PULSES*2] = {0};
+
+  int result = pi_2_dht_capture(pin, pulseCounts);
+  if (result != DHT_SUCCESS) {
+    return result;
+  }
+  return pi_2_dht_decode(type, pulseCounts, humidity, temperature);
+}
+
+int pi_2_dht_capture(int pin, int pulseCounts[DHT_PULSES*2]) {
+#ifdef PI_2_MMIO_FIXED_GPIO
+  if (pin != PI_2_MMIO_FIXED_GPIO) {
+    return DHT_ERROR_ARGUMENT;
+  }
+#endif
+
   // Initialize GPIO library.
   if (pi_2_mmio_init() < 0) {
     return DHT_ERROR_GPIO;
   }
 
-  // Store the count that each DHT bit pulse is low and high.
-  // Make sure array is initialized to start at zero.
-  int pulseCounts[DHT_PULSES*2] = {0};
-
   // Set pin to output.
-  pi_2_mmio_set_output(pin);
+  DHT_SET_OUTPUT(pin);
 
   // Bump up process priority and change scheduler to try to try to make process more 'real time'.
   set_max_priority();
 
   // Set pin high for ~500 milliseconds.
-  pi_2_mmio_set_high(pin);
+  DHT_SET_HIGH(pin);
   sleep_milliseconds(500);
 
   // The next calls are timing critical and care should be taken
   // to ensure no unnecssary work is done below.
 
   // Set pin low for ~20 milliseconds.
-  pi_2_mmio_set_low(pin);
+  DHT_SET_LOW(pin);
   busy_wait_milliseconds(20);
 
   // Set pin at input.
-  pi_2_mmio_set_input(pin);
+  DHT_SET_INPUT(pin);
   // Need a very short delay before reading pins or else value is sometimes still low.
   for (volatile int i = 0; i < 50; ++i) {
   }
 
   // Wait for DHT to pull pin low.
   uint32_t count = 0;
-  while (pi_2_mmio_input(pin)) {
+  while (DHT_INPUT(pin)) {
     if (++count >= DHT_MAXCOUNT) {
       // Timeout waiting for response.
       set_default_priority();
@@ -92,7 +112,7 @@ int pi_2_dht_read(int type, int pin, float* humidity, float* temperature) {
   // Record pulse widths for the expected result bits.
   for (int i=0; i < DHT_PULSES*2; i+=2) {
     // Count how long pin is low and store in pulseCounts[i]
-    while (!pi_2_mmio_input(pin)) {
+    while (!DHT_INPUT(pin)) {
       if (++pulseCounts[i] >= DHT_MAXCOUNT) {
         // Timeout waiting for response.
         set_default_priority();
@@ -100,7 +120,7 @@ int pi_2_dht_read(int type, int pin, float* humidity, float* temperature) {
       }
     }
     // Count how long pin is high and store in pulseCounts[i+1]
-    while (pi_2_mmio_input(pin)) {
+    while (DHT_INPUT(pin)) {
       if (++pulseCounts[i+1] >= DHT_MAXCOUNT) {
         // Timeout waiting for response.
         set_default_priority();
@@ -113,7 +133,10 @@ int pi_2_dht_read(int type, int pin, float* humidity, float* temperature) {
 
   // Drop back to normal priority.
   set_default_priority();
+  return DHT_SUCCESS;
+}
 
+int pi_2_dht_decode(int type, const int pulseCounts[DHT_PULSES*2], float* humidity, float* temperature) {
   // Compute the average low pulse width to use as a 50 microsecond reference threshold.
   // Ignore the first two readings because they are a constant 80 microsecond pulse.
   uint32_t threshold = 0;
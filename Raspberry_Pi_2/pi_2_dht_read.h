@@ -33,4 +33,34 @@
 // be returned.  Some errors can be ignored and retried, specifically DHT_ERROR_TIMEOUT or DHT_ERROR_CHECKSUM.
 int pi_2_dht_read(int sensor, int pin, float* humidity, float* temperature);
 
+// The two steps of pi_2_dht_read(), the capture of the pulses and their decoding, which work on the
+// widths of the low and high pulses of the response, in iterations of the polling loop.
+
+// Number of bit pulses to expect from the DHT.  Note that this is 41 because
+// the first pulse is a constant 50 microsecond pulse, with 40 pulses to represent
+// the data afterwards.
+#define DHT_PULSES 41
+
+// This is the only processor specific magic value, the maximum amount of time to
+// spin in a loop before bailing out and considering the read a timeout.  This should
+// be a high value, but if you're running on a much faster platform than a Raspberry
+// Pi or Beaglebone Black then it might need to be increased.
+// The loops of a build for a fixed pin ('make PIN=...') iterate 2 to 3 times faster
+// (see 'make gpio_bench'), so they get 4 times the limit, to keep the same margin over
+// the longest pulses (the 80 us of the response's preamble) in time.
+#define DHT_RUNTIME_PIN_MAXCOUNT 32000
+#ifdef PI_2_MMIO_FIXED_GPIO
+#define DHT_MAXCOUNT (4 * DHT_RUNTIME_PIN_MAXCOUNT)
+#else
+#define DHT_MAXCOUNT DHT_RUNTIME_PIN_MAXCOUNT
+#endif
+
+// Capture the pulse widths of a response of the sensor at GPIO pin into pulseCounts, which must be
+// zeroed. Returns DHT_SUCCESS, or a negative error value.
+int pi_2_dht_capture(int pin, int pulseCounts[DHT_PULSES*2]);
+
+// Decode the captured pulse widths into the humidity and temperature. Returns DHT_SUCCESS, or
+// DHT_ERROR_CHECKSUM.
+int pi_2_dht_decode(int sensor, const int pulseCounts[DHT_PULSES*2], float* humidity, float* temperature);
+
 #endif
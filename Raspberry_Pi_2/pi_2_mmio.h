@@ -35,6 +35,13 @@ extern volatile uint32_t* pi_2_mmio_gpio;
 
 int pi_2_mmio_init(void);
 
+#ifdef PI_2_MMIO_SIMULATED
+// In simulation builds (see Simulated/) the GPIO page is ordinary memory, and
+// the simulated sensor is stepped once per level read, so that the waveform
+// it drives advances in lock-step with the polling loops.
+void pi_2_mmio_sim_tick(void);
+#endif
+
 static inline void pi_2_mmio_set_input(const int gpio_number) {
   // Set GPIO register to 000 for specified GPIO number.
   *(pi_2_mmio_gpio+((gpio_number)/10)) &= ~(7<<(((gpio_number)%10)*3));
@@ -56,7 +63,44 @@ static inline void pi_2_mmio_set_low(const int gpio_number) {
 }
 
 static inline uint32_t pi_2_mmio_input(const int gpio_number) {
+#ifdef PI_2_MMIO_SIMULATED
+  pi_2_mmio_sim_tick();
+#endif
   return *(pi_2_mmio_gpio+13) & (1 << gpio_number);
 }
 
+#ifdef PI_2_MMIO_FIXED_GPIO
+// Built for a single GPIO (e.g., 'make PIN=17'): these are the accessors above
+// for that pin, as macros whose register offsets and masks are constant
+// expressions, folded at compile time even without optimizations. The input
+// is a single load and AND with a constant mask.
+#if PI_2_MMIO_FIXED_GPIO < 0 || PI_2_MMIO_FIXED_GPIO > 27
+#error "PI_2_MMIO_FIXED_GPIO must be a GPIO index between 0 and 27"
+#endif
+
+#define PI_2_MMIO_FIXED_FSEL_REG    (PI_2_MMIO_FIXED_GPIO / 10)
+#define PI_2_MMIO_FIXED_FSEL_SHIFT  ((PI_2_MMIO_FIXED_GPIO % 10) * 3)
+#define PI_2_MMIO_FIXED_MASK        (1u << PI_2_MMIO_FIXED_GPIO)
+
+#define pi_2_mmio_fixed_set_input() \
+  (*(pi_2_mmio_gpio+PI_2_MMIO_FIXED_FSEL_REG) &= \
+                                  ~(7u << PI_2_MMIO_FIXED_FSEL_SHIFT))
+
+#define pi_2_mmio_fixed_set_output() \
+  (pi_2_mmio_fixed_set_input(), \
+   *(pi_2_mmio_gpio+PI_2_MMIO_FIXED_FSEL_REG) |= \
+                                  (1u << PI_2_MMIO_FIXED_FSEL_SHIFT))
+
+#define pi_2_mmio_fixed_set_high()  (*(pi_2_mmio_gpio+7) = PI_2_MMIO_FIXED_MASK)
+
+#define pi_2_mmio_fixed_set_low()  (*(pi_2_mmio_gpio+10) = PI_2_MMIO_FIXED_MASK)
+
+#ifdef PI_2_MMIO_SIMULATED
+#define pi_2_mmio_fixed_input() \
+  (pi_2_mmio_sim_tick(), *(pi_2_mmio_gpio+13) & PI_2_MMIO_FIXED_MASK)
+#else
+#define pi_2_mmio_fixed_input()  (*(pi_2_mmio_gpio+13) & PI_2_MMIO_FIXED_MASK)
+#endif
+#endif
+
 #endif
@@ -0,0 +1,122 @@
+// Check of the republish of the adaptive mode ('make adaptive_check'): it
+// takes samples with sample_adaptively() from a simulated sensor that holds
+// a stable reading, and counts the text-collector files written: an
+// unchanged sample is only written again once '-P republish_seconds' have
+// passed. With readings that change at every sample, all of them are written.
+//
+// It also checks that a '-P' shorter than '-w' is refused, since the
+// republish can't be checked more often than the samples are taken. Like the
+// bench, it links the sampler's own object, with its main() renamed.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "rasppi_dht22_sampler.h"
+#include "sim_dht_generator.h"
+
+#define CHECK_SAMPLES   4         // at 0, 2, 4 and 6 seconds
+
+static char work_dir[] = "/tmp/adaptive_check.XXXXXX";
+
+static void default_config(struct configuration_settings * config) {
+  // the same defaults as the sampler's main()
+  struct configuration_settings defaults = {
+                          .dht22_gpio_idx = DEFAULT_DHT_GPIO_IDX,
+                          .wait_seconds = DEFAULT_WAIT_SECONDS,
+                          .udp_format = UDP_FORMAT_INFLUX,
+                          .udp_batch_samples = DEFAULT_UDP_BATCH_SAMPLES,
+                          .fleet_push_fd = -1
+                        };
+  *config = defaults;
+}
+
+// Exit status of parse_command_line() on "argv", in a child process.
+static int parse_status(char * argv[], int argc) {
+  fflush(NULL);
+  pid_t pid = fork();
+  if (pid == 0) {
+    struct configuration_settings config;
+    default_config(&config);
+    freopen("/dev/null", "w", stderr);
+    optind = 0;
+    parse_command_line(argc, argv, &config);
+    _exit(0);
+  }
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) != pid || ! WIFEXITED(status))
+    return -1;
+  return WEXITSTATUS(status);
+}
+
+// Number of files written by CHECK_SAMPLES samples every '-w 2' seconds,
+// with '-P 4'.
+static unsigned long long count_writes(bool stable_reading) {
+
+  static char * argv[] = { "adaptive_check", "-w", "2", "-c", "0.5",
+                           "-P", "4", NULL };
+  struct configuration_settings config;
+  default_config(&config);
+  optind = 0;
+  parse_command_line(sizeof argv / sizeof argv[0] - 1, argv, &config);
+  snprintf(config.text_collector_fname, sizeof config.text_collector_fname,
+           "%s/%s", work_dir, PROMETHEUS_TEXT_COLL_FILE);
+  struct textfile_timings timings = { 0 };
+  config.textfile_timings = &timings;
+
+  struct dht_sim_settings settings;
+  dht_sim_default_settings(&settings);
+  settings.gpio_idx = config.dht22_gpio_idx;
+  settings.hold_values = stable_reading;
+  dht_sim_configure(&settings);
+
+  struct adaptive_cadence cadence = { .period_seconds = config.wait_seconds };
+  for (int sample = 0; sample < CHECK_SAMPLES; sample++) {
+    if (sample > 0)
+      sleep(cadence.period_seconds);
+    sample_adaptively(&cadence, &config);
+  }
+  unlink(config.text_collector_fname);
+  return timings.writes;
+}
+
+int main(int argc, char *argv[]) {
+
+  if (argc != 1) {
+    printf("adaptive_check:\n"
+           "Check the republish of the adaptive mode on a simulated "
+           "sensor.\n\n"
+           "   adaptive_check\n");
+    exit(2);
+  }
+  if (mkdtemp(work_dir) == NULL) {
+    perror("ERROR: mkdtemp");
+    exit(3);
+  }
+
+  int failures = 0;
+
+  char * short_republish[] = { "adaptive_check", "-w", "4", "-c", "0.5",
+                               "-P", "2", NULL };
+  int status = parse_status(short_republish, 7);
+  printf("-w 4 -P 2: exit status %d: %s\n", status,
+         status == 32 ? "ok" : "FAILED");
+  failures += (status != 32);
+
+  // stable: written at 0 seconds, and republished at 4
+  unsigned long long writes = count_writes(true);
+  printf("stable reading: %llu of %d samples written: %s\n", writes,
+         CHECK_SAMPLES, writes == 2 ? "ok" : "FAILED");
+  failures += (writes != 2);
+
+  writes = count_writes(false);
+  printf("changing readings: %llu of %d samples written: %s\n", writes,
+         CHECK_SAMPLES, writes == CHECK_SAMPLES ? "ok" : "FAILED");
+  failures += (writes != CHECK_SAMPLES);
+
+  rmdir(work_dir);
+  return failures > 0 ? 6 : 0;
+}
@@ -0,0 +1,220 @@
+// Contention harness of the capture arbiter (capture_arbiter.h): several
+// processes, each one with its own simulated RHT03/DHT22 on its own memory
+// register page, read their sensors in a loop through the same arbiter.
+//
+// In the simulation the delays of pi_2_dht_read() take virtual time, so each
+// capture window is held a real "-H hold_ms" besides, as on a Raspberry Pi.
+// The harness checks that the windows never overlap, that every sampler got
+// its own slot, and that all the reads are right; with "-K", one process is
+// killed in the middle of a capture, and the others must take over its lock.
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Raspberry_Pi_2/pi_2_dht_read.h"
+#include "capture_arbiter.h"
+#include "common_dht_read.h"
+#include "sim_dht_generator.h"
+
+#define MAX_PROCESSES  CAPTURE_ARBITER_SLOTS
+
+// What the processes share, besides the arbiter
+struct contention_results {
+  int inside;                   // processes in a capture window right now
+  int max_inside;
+  unsigned long long overlaps;
+  struct {
+    int slot;
+    unsigned long long reads;
+    unsigned long long wrong_reads;
+    unsigned long long owner_deaths;
+    double wait_seconds;
+  } processes[MAX_PROCESSES];
+};
+
+static void show_help_and_exit(void) {
+  printf(
+    "arbiter_contention:\n"
+    "Read simulated RHT03/DHT22 sensors from several processes through the\n"
+    "same capture arbiter.\n\n"
+    "   arbiter_contention [-h] [-n processes] [-r reads] [-H hold_ms] [-K]\n"
+    "\n"
+    "     -n processes: number of samplers (default: 4, max: %d).\n"
+    "     -r reads: reads of each sampler (default: 20).\n"
+    "     -H hold_ms: real time each capture window lasts (default: 20).\n"
+    "     -K: kill the first sampler in the middle of its third capture.\n",
+    MAX_PROCESSES
+  );
+  exit(0);
+}
+
+static int convert_str_to_int(const char * str) {
+  char * num_end;
+  long value = strtol(str, &num_end, 0);
+  if (*num_end != '\0' || num_end == str || value < 0 || value > 1000000000) {
+    fprintf(stderr, "ERROR: It is not a proper number: '%s'\n", str);
+    exit(1);
+  }
+  return (int) value;
+}
+
+static void run_sampler(int idx, const char * arbiter_name, int num_reads,
+                        int hold_ms, bool die_in_capture,
+                        struct contention_results * results) {
+
+  struct capture_arbiter * arbiter = capture_arbiter_open(arbiter_name, -1);
+  if (arbiter == NULL)
+    exit(3);
+  results->processes[idx].slot = capture_arbiter_slot(arbiter);
+
+  struct dht_sim_settings settings;
+  dht_sim_default_settings(&settings);
+  settings.seed = idx + 1;
+  dht_sim_configure(&settings);
+
+  for (int read = 0; read < num_reads; read++) {
+    if (capture_arbiter_acquire(arbiter) != 0)
+      exit(4);
+    int inside = __atomic_add_fetch(&results->inside, 1, __ATOMIC_SEQ_CST);
+    if (inside > 1)
+      __atomic_add_fetch(&results->overlaps, 1, __ATOMIC_SEQ_CST);
+    int max_inside = __atomic_load_n(&results->max_inside, __ATOMIC_SEQ_CST);
+    while (inside > max_inside &&
+           ! __atomic_compare_exchange_n(&results->max_inside, &max_inside,
+                                         inside, false, __ATOMIC_SEQ_CST,
+                                         __ATOMIC_SEQ_CST))
+      ;
+
+    if (die_in_capture && read == 2) {
+      __atomic_sub_fetch(&results->inside, 1, __ATOMIC_SEQ_CST);
+      raise(SIGKILL);     // with the lock held
+    }
+
+    float humidity, temperature;
+    int result = pi_2_dht_read(DHT22, settings.gpio_idx,
+                               &humidity, &temperature);
+    const struct dht_sim_transaction * sent = dht_sim_last_transaction();
+    if (result != DHT_SUCCESS || humidity != sent->humidity ||
+        temperature != sent->temperature)
+      results->processes[idx].wrong_reads++;
+    results->processes[idx].reads++;
+    usleep(hold_ms * 1000);
+
+    __atomic_sub_fetch(&results->inside, 1, __ATOMIC_SEQ_CST);
+    capture_arbiter_release(arbiter);
+    usleep(1000);       // (the rest of a sampler's loop)
+  }
+
+  results->processes[idx].wait_seconds = capture_arbiter_wait_seconds(arbiter);
+  results->processes[idx].owner_deaths = capture_arbiter_owner_deaths(arbiter);
+  capture_arbiter_close(arbiter);
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+
+  int num_processes = 4, num_reads = 20, hold_ms = 20;
+  bool kill_one = false;
+
+  int c;
+  while ((c = getopt(argc, argv, "hn:r:H:K")) != -1)
+    switch (c)
+      {
+      case 'h':
+        show_help_and_exit();
+        break;
+      case 'n':
+        num_processes = convert_str_to_int(optarg);
+        break;
+      case 'r':
+        num_reads = convert_str_to_int(optarg);
+        break;
+      case 'H':
+        hold_ms = convert_str_to_int(optarg);
+        break;
+      case 'K':
+        kill_one = true;
+        break;
+      default:
+        exit(2);
+      }
+  if (num_processes < 1 || num_processes > MAX_PROCESSES)
+    show_help_and_exit();
+
+  struct contention_results * results =
+        mmap(NULL, sizeof *results, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (results == MAP_FAILED) {
+    perror("ERROR: mmap");
+    exit(2);
+  }
+
+  char arbiter_name[32];
+  snprintf(arbiter_name, sizeof arbiter_name, "contention.%d", (int)getpid());
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int idx = 0; idx < num_processes; idx++) {
+    pid_t pid = fork();
+    if (pid == -1) {
+      perror("ERROR: fork");
+      exit(2);
+    }
+    if (pid == 0)
+      run_sampler(idx, arbiter_name, num_reads, hold_ms,
+                  kill_one && idx == 0, results);
+  }
+
+  int failed_processes = 0;
+  for (int idx = 0; idx < num_processes; idx++) {
+    int status;
+    wait(&status);
+    if (! WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      failed_processes++;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  char shm_name[64];
+  snprintf(shm_name, sizeof shm_name, CAPTURE_ARBITER_SHM_PREFIX "%s",
+           arbiter_name);
+  shm_unlink(shm_name);
+
+  unsigned long long reads = 0, wrong_reads = 0, owner_deaths = 0;
+  double wait_seconds = 0;
+  bool distinct_slots = true;
+  for (int idx = 0; idx < num_processes; idx++) {
+    printf("sampler %2d: slot %2d, %llu reads, %llu wrong, waited %.3f s\n",
+           idx, results->processes[idx].slot, results->processes[idx].reads,
+           results->processes[idx].wrong_reads,
+           results->processes[idx].wait_seconds);
+    reads += results->processes[idx].reads;
+    wrong_reads += results->processes[idx].wrong_reads;
+    owner_deaths += results->processes[idx].owner_deaths;
+    wait_seconds += results->processes[idx].wait_seconds;
+    for (int other = 0; other < idx; other++)
+      if (results->processes[other].slot == results->processes[idx].slot)
+        distinct_slots = false;
+  }
+  double elapsed = (end.tv_sec - start.tv_sec) +
+                   (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("%d samplers, %llu reads (%llu wrong) in %.2f s: overlapping "
+         "captures: %llu (max %d at once), total wait %.3f s, owner deaths "
+         "recovered: %llu, distinct slots: %s\n",
+         num_processes, reads, wrong_reads, elapsed, results->overlaps,
+         results->max_inside, wait_seconds, owner_deaths,
+         distinct_slots ? "yes" : "no");
+
+  bool failed = (results->overlaps > 0 || wrong_reads > 0 ||
+                 ! distinct_slots ||
+                 failed_processes != (kill_one ? 1 : 0) ||
+                 owner_deaths != (kill_one ? 1 : 0));
+  return failed ? 6 : 0;
+}
@@ -0,0 +1,536 @@
+// Benchmark harness of the stages of the sampler, each one in isolation and
+// end to end against the simulated RHT03/DHT22 sensor ('make bench'):
+//
+//   parse_command_line   the command-line, with its Prometheus labels
+//   dht_decode           pi_2_dht_decode() on pulse vectors recorded from the
+//                        simulated sensor
+//   render_prometheus    dht22_values_to_prometheus() into a memory buffer
+//   publish_textfile     the temporary file and rename() of a sample
+//   publish_textfile_uring  the same, through io_uring (textfile_ring.h),
+//                        from the submission to the completion
+//   publish_tick_8       the textfiles of a tick of 8 sensors, one by one...
+//   publish_tick_8_uring ... and in one io_uring submission
+//   sample_loop          a whole sample: read of the simulated sensor and
+//                        publication
+//
+// For each stage it prints, as JSON, the wall-clock ns/op (the median of
+// several rounds), the heap allocations and the system calls per op, and how
+// much the RSS grew during the stage. Given a baseline in that same JSON
+// (e.g., the output of a previous run), it compares each figure against it,
+// and exits with an error if the allocations or the system calls per op,
+// which are deterministic, are worse by more than a threshold. The timings
+// and the RSS depend on the machine and its load: they are only reported,
+// unless a (looser) threshold is given for the timings too.
+//
+// The system calls are counted by tracing (ptrace(2)) a child process that
+// runs the stage, and the allocations by wrapping malloc(). The harness
+// links the sampler's own object (built with its main() renamed, see the
+// Makefile), to run its functions as they are.
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Raspberry_Pi_2/pi_2_dht_read.h"
+#include "rasppi_dht22_sampler.h"
+#include "sim_dht_generator.h"
+#include "textfile_ring.h"
+
+#define BENCH_ROUNDS            5
+#define BENCH_MAX_TRACED_OPS    200
+#define BENCH_MAX_STAGES        16
+#define RECORDED_VECTORS        64
+#define DEFAULT_THRESHOLD_PCT   20.0
+#define NO_THRESHOLD            -1.0
+#define TICK_SENSORS            8
+
+// Allocation counter: every malloc(), calloc() and realloc() of the process,
+// the C library's own included (fopen(), regcomp(), ...)
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t num, size_t size);
+extern void * __libc_realloc(void * ptr, size_t size);
+
+static unsigned long long allocations = 0;
+
+void * malloc(size_t size) {
+  allocations++;
+  return __libc_malloc(size);
+}
+
+void * calloc(size_t num, size_t size) {
+  allocations++;
+  return __libc_calloc(num, size);
+}
+
+void * realloc(void * ptr, size_t size) {
+  allocations++;
+  return __libc_realloc(ptr, size);
+}
+
+struct bench_stage {
+  const char * name;
+  void (*run)(void);            // one op
+  long long iterations;         // per round
+};
+
+struct bench_result {
+  char name[64];
+  long long iterations;
+  double ns_per_op;
+  double allocs_per_op;
+  double syscalls_per_op;       // -1: unknown (ptrace(2) not allowed)
+  long rss_growth_kb;
+};
+
+// The state of the stages
+static struct configuration_settings bench_config;
+static struct configuration_settings uring_config;   // (NULL ring: no io_uring)
+static struct configuration_settings tick_configs[TICK_SENSORS];
+static char label_args[4][32] = { "room=\"lab\"", "rack=\"r12\"",
+                                  "floor=\"3\"", "site=\"hq\"" };
+static char * parse_argv[] = { "rasppi_dht22_sampler", "-w", "30",
+                               "-d", "/tmp", label_args[0], label_args[1],
+                               label_args[2], label_args[3], NULL };
+static int recorded_pulses[RECORDED_VECTORS][DHT_PULSES*2];
+static int next_vector = 0;
+static char render_buffer[4096];
+static FILE * render_stream;
+static volatile float result_sink;
+
+static void bench_help_and_exit(void) {
+  printf(
+    "dht_bench:\n"
+    "Benchmark the stages of the sampler against a simulated RHT03/DHT22.\n\n"
+    "Optional command-line arguments:\n"
+    "   [-h] [-n scale] [-o output.json] [-b baseline.json]"
+      " [-t threshold_percent] [-T timing_threshold_percent]\n"
+    "\n"
+    "     -n scale: multiply the iterations of every stage (default: 1).\n"
+    "     -o output.json: write the results there too (e.g., a new "
+                          "baseline).\n"
+    "     -b baseline.json: compare against these results.\n"
+    "     -t threshold_percent: allocations or system calls per op worse "
+                          "than the baseline by more than this are a "
+                          "regression (default: %.0f).\n"
+    "     -T timing_threshold_percent: so is a ns/op worse by more than this "
+                          "(default: the timings are only reported).\n",
+    DEFAULT_THRESHOLD_PCT
+  );
+  exit(0);
+}
+
+static void default_config(struct configuration_settings * config) {
+  // the same defaults as the sampler's main()
+  struct configuration_settings defaults = {
+                          .dht22_gpio_idx = DEFAULT_DHT_GPIO_IDX,
+                          .wait_seconds = DEFAULT_WAIT_SECONDS,
+                          .text_collector_fname =
+                                 PROMETHEUS_TEXT_COLL_DIR "/"
+                                 PROMETHEUS_TEXT_COLL_FILE,
+                          .udp_format = UDP_FORMAT_INFLUX,
+                          .udp_batch_samples = DEFAULT_UDP_BATCH_SAMPLES,
+                          .fleet_push_fd = -1
+                        };
+  *config = defaults;
+}
+
+static void run_parse_command_line(void) {
+  struct configuration_settings config;
+  default_config(&config);
+  optind = 0;       // (it re-initializes glibc's getopt())
+  parse_command_line(sizeof parse_argv / sizeof parse_argv[0] - 1,
+                     parse_argv, &config);
+  free(config.prometheus_labels);
+}
+
+static void run_dht_decode(void) {
+  float humidity, temperature;
+  pi_2_dht_decode(DHT22, recorded_pulses[next_vector], &humidity,
+                  &temperature);
+  next_vector = (next_vector + 1) % RECORDED_VECTORS;
+  result_sink = humidity + temperature;
+}
+
+static void run_render_prometheus(void) {
+  rewind(render_stream);
+  dht22_values_to_prometheus(render_stream, 21.5, 45.2, &bench_config);
+}
+
+static void run_publish_textfile(void) {
+  publish_dht22_sample(21.5, 45.2, 0, &bench_config);
+}
+
+static void run_publish_textfile_uring(void) {
+  publish_dht22_sample(21.5, 45.2, 0, &uring_config);
+  textfile_ring_wait(uring_config.textfile_ring);
+}
+
+static void run_publish_tick(void) {
+  for (int sensor = 0; sensor < TICK_SENSORS; sensor++)
+    write_textfile(21.5, 45.2, 0, &tick_configs[sensor]);
+}
+
+static void run_publish_tick_uring(void) {
+  for (int sensor = 0; sensor < TICK_SENSORS; sensor++)
+    queue_textfile_write(21.5, 45.2, 0, &tick_configs[sensor]);
+  textfile_ring_submit(uring_config.textfile_ring);
+  textfile_ring_wait(uring_config.textfile_ring);
+}
+
+static void run_sample_loop(void) {
+  sample_dht22_sensor_to_prometheus(&bench_config);
+}
+
+static void setup_stages(const char * work_dir) {
+
+  default_config(&bench_config);
+  optind = 0;
+  parse_command_line(sizeof parse_argv / sizeof parse_argv[0] - 1,
+                     parse_argv, &bench_config);
+  snprintf(bench_config.text_collector_fname,
+           sizeof bench_config.text_collector_fname, "%s/%s",
+           work_dir, PROMETHEUS_TEXT_COLL_FILE);
+
+  // (the textfile metrics of '-i' aren't printed: so both paths write the
+  // same files)
+  uring_config = bench_config;
+  uring_config.textfile_ring = textfile_ring_create(false);
+  for (int sensor = 0; sensor < TICK_SENSORS; sensor++) {
+    tick_configs[sensor] = uring_config;
+    snprintf(tick_configs[sensor].text_collector_fname,
+             sizeof tick_configs[sensor].text_collector_fname,
+             "%s/dht22_%d.prom", work_dir, sensor);
+  }
+
+  render_stream = fmemopen(render_buffer, sizeof render_buffer, "w");
+  if (render_stream == NULL) {
+    perror("ERROR: fmemopen");
+    exit(3);
+  }
+
+  // record the pulse widths of a series of responses, with jitter
+  struct dht_sim_settings settings;
+  dht_sim_default_settings(&settings);
+  settings.gpio_idx = bench_config.dht22_gpio_idx;
+  settings.jitter_ns = 5000;
+  dht_sim_configure(&settings);
+  for (int vector = 0; vector < RECORDED_VECTORS; vector++) {
+    if (pi_2_dht_capture(settings.gpio_idx,
+                         recorded_pulses[vector]) != DHT_SUCCESS) {
+      fprintf(stderr, "ERROR: couldn't record the pulses of the simulated "
+                      "sensor.\n");
+      exit(4);
+    }
+  }
+  settings.jitter_ns = 0;
+  dht_sim_configure(&settings);
+}
+
+static uint64_t now_ns(void) {
+  struct timespec curr_time;
+  clock_gettime(CLOCK_MONOTONIC, &curr_time);
+  return (uint64_t)curr_time.tv_sec * 1000000000 + curr_time.tv_nsec;
+}
+
+static long resident_set_kb(void) {
+  FILE * statm = fopen("/proc/self/statm", "r");
+  if (statm == NULL)
+    return -1;
+  long size_pages = 0, resident_pages = -1;
+  if (fscanf(statm, "%ld %ld", &size_pages, &resident_pages) != 2)
+    resident_pages = -1;
+  fclose(statm);
+  return resident_pages < 0 ? -1 :
+                              resident_pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Run "iterations" ops of the stage in a child process traced by this one,
+// and count the system calls between two getppid() markers around them.
+static double count_syscalls_per_op(const struct bench_stage * stage,
+                                    long long iterations) {
+  fflush(NULL);
+  pid_t pid = fork();
+  if (pid == -1)
+    return -1;
+  if (pid == 0) {
+    if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1)
+      _exit(1);
+    raise(SIGSTOP);
+    getppid();
+    for (long long op = 0; op < iterations; op++)
+      stage->run();
+    getppid();
+    _exit(0);
+  }
+
+  int status;
+  if (waitpid(pid, &status, 0) == -1 || ! WIFSTOPPED(status)) {
+    waitpid(pid, NULL, 0);
+    return -1;      // e.g., no ptrace(2) in this container
+  }
+  ptrace(PTRACE_SETOPTIONS, pid, NULL,
+         PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL);
+
+  long long syscalls = 0;
+  int markers = 0, signal_to_deliver = 0;
+  while (ptrace(PTRACE_SYSCALL, pid, NULL, signal_to_deliver) != -1 &&
+         waitpid(pid, &status, 0) != -1 && WIFSTOPPED(status)) {
+    signal_to_deliver = 0;
+    if (WSTOPSIG(status) != (SIGTRAP | 0x80)) {
+      signal_to_deliver = WSTOPSIG(status);
+      continue;
+    }
+    struct __ptrace_syscall_info info;
+    if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof info, &info) <= 0 ||
+        info.op != PTRACE_SYSCALL_INFO_ENTRY)
+      continue;
+    if (info.entry.nr == SYS_getppid)
+      markers++;
+    else if (markers == 1)
+      syscalls++;
+  }
+  waitpid(pid, NULL, 0);
+  return markers >= 2 ? (double)syscalls / iterations : -1;
+}
+
+static int compare_doubles(const void * a, const void * b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void run_stage(const struct bench_stage * stage,
+                      struct bench_result * result) {
+
+  snprintf(result->name, sizeof result->name, "%s", stage->name);
+  result->iterations = stage->iterations;
+
+  long rss_before = resident_set_kb();
+  stage->run();     // warm-up
+  double round_ns[BENCH_ROUNDS];
+  unsigned long long allocs = 0;
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    unsigned long long allocs_before = allocations;
+    uint64_t start = now_ns();
+    for (long long op = 0; op < stage->iterations; op++)
+      stage->run();
+    round_ns[round] = (double)(now_ns() - start) / stage->iterations;
+    allocs = allocations - allocs_before;
+  }
+  qsort(round_ns, BENCH_ROUNDS, sizeof round_ns[0], compare_doubles);
+  result->ns_per_op = round_ns[BENCH_ROUNDS / 2];
+  result->allocs_per_op = (double)allocs / stage->iterations;
+  long rss_after = resident_set_kb();
+  result->rss_growth_kb = (rss_before < 0 || rss_after < 0) ? -1 :
+                                                    rss_after - rss_before;
+  result->syscalls_per_op = count_syscalls_per_op(stage,
+          stage->iterations < BENCH_MAX_TRACED_OPS ? stage->iterations :
+                                                     BENCH_MAX_TRACED_OPS);
+}
+
+static void print_results(FILE * output, const struct bench_result * results,
+                          int num_results) {
+  fprintf(output, "{\n  \"benchmarks\": [\n");
+  for (int i = 0; i < num_results; i++)
+    fprintf(output, "    {\"name\": \"%s\", \"iterations\": %lld, "
+                    "\"ns_per_op\": %.1f, \"allocs_per_op\": %.2f, "
+                    "\"syscalls_per_op\": %.2f, \"rss_growth_kb\": %ld}%s\n",
+                    results[i].name, results[i].iterations,
+                    results[i].ns_per_op, results[i].allocs_per_op,
+                    results[i].syscalls_per_op, results[i].rss_growth_kb,
+                    i + 1 < num_results ? "," : "");
+  fprintf(output, "  ]\n}\n");
+}
+
+// Read the results of a previous run, as printed by print_results()
+static int read_results(const char * fname, struct bench_result * results) {
+  FILE * input = fopen(fname, "r");
+  if (input == NULL) {
+    fprintf(stderr, "ERROR: Could not open the baseline '%s'.\n", fname);
+    exit(5);
+  }
+  int num_results = 0;
+  char line[512];
+  while (fgets(line, sizeof line, input) != NULL &&
+         num_results < BENCH_MAX_STAGES) {
+    struct bench_result * result = &results[num_results];
+    if (sscanf(line, " {\"name\": \"%63[^\"]\", \"iterations\": %lld, "
+                     "\"ns_per_op\": %lf, \"allocs_per_op\": %lf, "
+                     "\"syscalls_per_op\": %lf, \"rss_growth_kb\": %ld}",
+               result->name, &result->iterations, &result->ns_per_op,
+               &result->allocs_per_op, &result->syscalls_per_op,
+               &result->rss_growth_kb) == 6)
+      num_results++;
+  }
+  fclose(input);
+  return num_results;
+}
+
+// (with NO_THRESHOLD, the figure is only reported)
+static bool is_regression(const char * stage, const char * figure,
+                          double baseline, double current,
+                          double threshold_pct) {
+  if (baseline < 0)
+    return false;     // not in the baseline
+  if (current < 0) {
+    // (e.g., no ptrace(2) in this container: a gated figure that can't be
+    // checked fails, rather than passing unchecked)
+    fprintf(stderr, "%-20s %-16s %12.2f -> not measured%s\n", stage, figure,
+            baseline, threshold_pct != NO_THRESHOLD ? "  NOT CHECKED" : "");
+    return threshold_pct != NO_THRESHOLD;
+  }
+  bool regression = threshold_pct != NO_THRESHOLD &&
+                    current > baseline * (1 + threshold_pct / 100) + 1e-9;
+  fprintf(stderr, "%-20s %-16s %12.2f -> %12.2f  (%+7.1f%%)%s\n",
+          stage, figure, baseline, current,
+          baseline > 0 ? 100 * (current - baseline) / baseline : 0.0,
+          regression ? "  REGRESSION" : "");
+  return regression;
+}
+
+static int compare_results(const struct bench_result * baseline,
+                           int num_baseline,
+                           const struct bench_result * results,
+                           int num_results, double threshold_pct,
+                           double timing_threshold_pct) {
+  int regressions = 0;
+  for (int i = 0; i < num_results; i++) {
+    const struct bench_result * base = NULL;
+    for (int j = 0; j < num_baseline; j++)
+      if (strcmp(baseline[j].name, results[i].name) == 0)
+        base = &baseline[j];
+    if (base == NULL) {
+      fprintf(stderr, "%-20s not in the baseline\n", results[i].name);
+      continue;
+    }
+    regressions += is_regression(results[i].name, "ns_per_op",
+                                 base->ns_per_op, results[i].ns_per_op,
+                                 timing_threshold_pct);
+    regressions += is_regression(results[i].name, "allocs_per_op",
+                                 base->allocs_per_op,
+                                 results[i].allocs_per_op, threshold_pct);
+    regressions += is_regression(results[i].name, "syscalls_per_op",
+                                 base->syscalls_per_op,
+                                 results[i].syscalls_per_op, threshold_pct);
+    is_regression(results[i].name, "rss_growth_kb", base->rss_growth_kb,
+                  results[i].rss_growth_kb, NO_THRESHOLD);
+  }
+  return regressions;
+}
+
+int main(int argc, char *argv[]) {
+
+  long long scale = 1;
+  const char * output_fname = NULL;
+  const char * baseline_fname = NULL;
+  double threshold_pct = DEFAULT_THRESHOLD_PCT;
+  double timing_threshold_pct = NO_THRESHOLD;
+
+  int c;
+  while ((c = getopt(argc, argv, "hn:o:b:t:T:")) != -1)
+    switch (c)
+      {
+      case 'h':
+        bench_help_and_exit();
+        break;
+      case 'n':
+        scale = convert_str_to_int(optarg);
+        break;
+      case 'o':
+        output_fname = optarg;
+        break;
+      case 'b':
+        baseline_fname = optarg;
+        break;
+      case 't':
+        threshold_pct = convert_str_to_float(optarg);
+        break;
+      case 'T':
+        timing_threshold_pct = convert_str_to_float(optarg);
+        if (timing_threshold_pct < 0)
+          bench_help_and_exit();
+        break;
+      default:
+        exit(2);
+      }
+  if (scale < 1 || threshold_pct < 0)
+    bench_help_and_exit();
+
+  char work_dir[] = "/tmp/dht_bench.XXXXXX";
+  if (mkdtemp(work_dir) == NULL) {
+    perror("ERROR: mkdtemp");
+    exit(3);
+  }
+  setup_stages(work_dir);
+
+  // the sampler logs each rename() to stderr
+  fflush(stderr);
+  int saved_stderr = dup(STDERR_FILENO);
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, STDERR_FILENO);
+  close(null_fd);
+
+  bool uring = (uring_config.textfile_ring != NULL);
+  const struct bench_stage all_stages[] = {
+    { "parse_command_line", run_parse_command_line, 2000 * scale },
+    { "dht_decode",         run_dht_decode,         200000 * scale },
+    { "render_prometheus",  run_render_prometheus,  50000 * scale },
+    { "publish_textfile",   run_publish_textfile,   2000 * scale },
+    { "publish_textfile_uring", uring ? run_publish_textfile_uring : NULL,
+                                                    2000 * scale },
+    { "publish_tick_8",     run_publish_tick,       250 * scale },
+    { "publish_tick_8_uring", uring ? run_publish_tick_uring : NULL,
+                                                    250 * scale },
+    { "sample_loop",        run_sample_loop,        200 * scale },
+  };
+  // (without io_uring, its stages are left out)
+  struct bench_stage stages[BENCH_MAX_STAGES];
+  int num_stages = 0;
+  for (int i = 0; i < sizeof all_stages / sizeof all_stages[0]; i++)
+    if (all_stages[i].run != NULL)
+      stages[num_stages++] = all_stages[i];
+  struct bench_result results[BENCH_MAX_STAGES];
+  for (int i = 0; i < num_stages; i++)
+    run_stage(&stages[i], &results[i]);
+
+  fflush(stderr);
+  dup2(saved_stderr, STDERR_FILENO);
+  close(saved_stderr);
+  unlink(bench_config.text_collector_fname);
+  for (int sensor = 0; sensor < TICK_SENSORS; sensor++)
+    unlink(tick_configs[sensor].text_collector_fname);
+  rmdir(work_dir);
+
+  print_results(stdout, results, num_stages);
+  if (output_fname != NULL) {
+    FILE * output = fopen(output_fname, "w");
+    if (output == NULL) {
+      fprintf(stderr, "ERROR: Could not write '%s'.\n", output_fname);
+      exit(5);
+    }
+    print_results(output, results, num_stages);
+    fclose(output);
+  }
+
+  if (baseline_fname != NULL) {
+    struct bench_result baseline[BENCH_MAX_STAGES];
+    int num_baseline = read_results(baseline_fname, baseline);
+    int regressions = compare_results(baseline, num_baseline, results,
+                                      num_stages, threshold_pct,
+                                      timing_threshold_pct);
+    if (regressions > 0) {
+      fprintf(stderr, "%d figure(s) worse by over %.1f%% against '%s', or "
+                      "not measured.\n",
+              regressions, threshold_pct, baseline_fname);
+      return 7;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,334 @@
+// Soak harness of pi_2_dht_read() against the simulated RHT03/DHT22 sensor.
+//
+// It runs many reads through the unmodified decoder in
+// Raspberry_Pi_2/pi_2_dht_read.c, checks every successful read against the
+// values the simulated sensor really sent, and reports periodically the
+// success rate, the wall-clock latency percentiles of the reads (the CPU cost
+// of the decoder), and the growth of the resident set size.
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Raspberry_Pi_2/pi_2_dht_read.h"
+#include "common_dht_read.h"
+#include "sim_dht_generator.h"
+
+#define DEFAULT_NUM_READS     100000
+#define DEFAULT_REPORT_EVERY  10000
+
+// Log-linear latency histogram: exact up to 64 ns, then 32 buckets for each
+// power of two, which keeps the relative error of a percentile under 3 %.
+#define HIST_SUB_BITS      5
+#define HIST_LINEAR_LIMIT  (2 << HIST_SUB_BITS)
+#define HIST_BUCKETS       (HIST_LINEAR_LIMIT + (64 - HIST_SUB_BITS - 1) * \
+                                                (1 << HIST_SUB_BITS))
+
+struct latency_histogram {
+  uint64_t counts[HIST_BUCKETS];
+  uint64_t total;
+  uint64_t max;
+};
+
+struct soak_counters {
+  uint64_t reads;
+  uint64_t success;
+  uint64_t wrong_values;        // DHT_SUCCESS, but not what the sensor sent
+  uint64_t timeouts;
+  uint64_t checksum_errors;
+  uint64_t other_errors;
+  uint64_t clean_reads;         // reads of frames without faults injected...
+  uint64_t clean_success;       // ... and how many of them were right
+  uint64_t faults[3];           // frames with each DHT_SIM_FAULT_* injected
+  uint64_t virtual_ns;          // virtual time spent inside pi_2_dht_read()
+};
+
+static void show_help_and_exit(void) {
+  printf(
+    "dht_soak:\n"
+    "Soak pi_2_dht_read() against a simulated RHT03/DHT22 sensor.\n\n"
+    "Optional command-line arguments:\n"
+    "   [-h] [-n reads] [-r report_every] [-s seed] [-p ns_per_poll]\n"
+    "   [-l bit_low_us] [-z zero_high_us] [-o one_high_us] [-j jitter_us]\n"
+    "   [-D prob_dropped_edge] [-S prob_stuck_low] [-C prob_bad_checksum]\n"
+    "\n"
+    "     -n reads: number of reads to run (default: %d).\n"
+    "     -r report_every: reads between progress reports (default: %d).\n"
+    "     -s seed: seed of the simulated values and faults (default: 1).\n"
+    "     -p ns_per_poll: virtual nanoseconds taken by each GPIO read.\n"
+    "     -l, -z, -o: width in microseconds of the low pulse before each bit,\n"
+    "                 and of the high pulse of a '0' and of a '1' bit.\n"
+    "     -j jitter_us: max +/- jitter added to every pulse width.\n"
+    "     -D, -S, -C: probability (0 to 1) of a frame with a dropped pulse,\n"
+    "                 with the line stuck low, or with a bad checksum.\n",
+    DEFAULT_NUM_READS, DEFAULT_REPORT_EVERY
+  );
+  exit(0);
+}
+
+static long long convert_str_to_ll(const char * str) {
+  char * num_end;
+  errno = 0;
+  long long value = strtoll(str, &num_end, 0);
+  if (errno != 0 || *num_end != '\0' || num_end == str || value < 0) {
+    fprintf(stderr, "ERROR: It is not a proper non-negative number: '%s'\n",
+            str);
+    exit(1);
+  }
+  return value;
+}
+
+static double convert_str_to_probability(const char * str) {
+  char * num_end;
+  errno = 0;
+  double value = strtod(str, &num_end);
+  if (errno != 0 || *num_end != '\0' || num_end == str ||
+      value < 0.0 || value > 1.0) {
+    fprintf(stderr, "ERROR: It is not a probability between 0 and 1: '%s'\n",
+            str);
+    exit(2);
+  }
+  return value;
+}
+
+static int histogram_bucket(uint64_t value) {
+  if (value < HIST_LINEAR_LIMIT)
+    return value;
+  int msb = 63 - __builtin_clzll(value);
+  int sub = (value >> (msb - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1);
+  return HIST_LINEAR_LIMIT + (msb - HIST_SUB_BITS - 1) * (1 << HIST_SUB_BITS)
+                           + sub;
+}
+
+static uint64_t histogram_bucket_value(int bucket) {
+  if (bucket < HIST_LINEAR_LIMIT)
+    return bucket;
+  int msb = (bucket - HIST_LINEAR_LIMIT) / (1 << HIST_SUB_BITS)
+            + HIST_SUB_BITS + 1;
+  int sub = (bucket - HIST_LINEAR_LIMIT) % (1 << HIST_SUB_BITS);
+  return ((uint64_t)((1 << HIST_SUB_BITS) | sub)) << (msb - HIST_SUB_BITS);
+}
+
+static void histogram_record(struct latency_histogram * hist, uint64_t value) {
+  hist->counts[histogram_bucket(value)]++;
+  hist->total++;
+  if (value > hist->max)
+    hist->max = value;
+}
+
+static uint64_t histogram_percentile(const struct latency_histogram * hist,
+                                     double percentile) {
+  if (hist->total == 0)
+    return 0;
+  uint64_t rank = (uint64_t)(percentile / 100.0 * hist->total);
+  if (rank >= hist->total)
+    rank = hist->total - 1;
+  uint64_t seen = 0;
+  for (int bucket = 0; bucket < HIST_BUCKETS; bucket++) {
+    seen += hist->counts[bucket];
+    if (seen > rank)
+      return histogram_bucket_value(bucket);
+  }
+  return hist->max;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec curr_time;
+  clock_gettime(CLOCK_MONOTONIC, &curr_time);
+  return (uint64_t)curr_time.tv_sec * 1000000000 + curr_time.tv_nsec;
+}
+
+static long resident_set_kb(void) {
+  FILE * statm = fopen("/proc/self/statm", "r");
+  if (statm == NULL)
+    return -1;
+  long size_pages = 0, resident_pages = -1;
+  if (fscanf(statm, "%ld %ld", &size_pages, &resident_pages) != 2)
+    resident_pages = -1;
+  fclose(statm);
+  return resident_pages < 0 ? -1 : resident_pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+  return whole ? 100.0 * part / whole : 0.0;
+}
+
+static void report_progress(const struct soak_counters * counters,
+                            const struct latency_histogram * hist,
+                            long initial_rss_kb) {
+  long rss_kb = resident_set_kb();
+  printf("reads=%llu success=%.3f%% wrong_values=%llu "
+         "p50_ns=%llu p99_ns=%llu rss_kb=%ld rss_growth_kb=%ld\n",
+         (unsigned long long)counters->reads,
+         percent(counters->success, counters->reads),
+         (unsigned long long)counters->wrong_values,
+         (unsigned long long)histogram_percentile(hist, 50.0),
+         (unsigned long long)histogram_percentile(hist, 99.0),
+         rss_kb, rss_kb - initial_rss_kb);
+  fflush(stdout);
+}
+
+static void report_summary(const struct soak_counters * counters,
+                           const struct latency_histogram * hist,
+                           long initial_rss_kb, uint64_t elapsed_ns) {
+  long rss_kb = resident_set_kb();
+  printf("\nSummary:\n");
+  printf("  reads:                 %llu\n",
+         (unsigned long long)counters->reads);
+  printf("  success:               %llu (%.3f%%)\n",
+         (unsigned long long)counters->success,
+         percent(counters->success, counters->reads));
+  printf("  success, wrong values: %llu\n",
+         (unsigned long long)counters->wrong_values);
+  printf("  timeouts:              %llu\n",
+         (unsigned long long)counters->timeouts);
+  printf("  checksum errors:       %llu\n",
+         (unsigned long long)counters->checksum_errors);
+  printf("  other errors:          %llu\n",
+         (unsigned long long)counters->other_errors);
+  printf("  accuracy, clean frames: %.3f%% of %llu\n",
+         percent(counters->clean_success, counters->clean_reads),
+         (unsigned long long)counters->clean_reads);
+  printf("  frames with faults:    dropped_edge=%llu stuck_low=%llu "
+         "bad_checksum=%llu\n",
+         (unsigned long long)counters->faults[0],
+         (unsigned long long)counters->faults[1],
+         (unsigned long long)counters->faults[2]);
+  printf("  latency (wall-clock):  p50=%llu ns p90=%llu ns p99=%llu ns "
+         "p99.9=%llu ns max=%llu ns\n",
+         (unsigned long long)histogram_percentile(hist, 50.0),
+         (unsigned long long)histogram_percentile(hist, 90.0),
+         (unsigned long long)histogram_percentile(hist, 99.0),
+         (unsigned long long)histogram_percentile(hist, 99.9),
+         (unsigned long long)hist->max);
+  printf("  simulated capture:     %.1f us per read\n",
+         counters->reads ?
+           counters->virtual_ns / 1000.0 / counters->reads : 0.0);
+  printf("  throughput:            %.0f reads/s\n",
+         elapsed_ns ? counters->reads * 1e9 / elapsed_ns : 0.0);
+  printf("  rss:                   %ld kB (growth %ld kB)\n",
+         rss_kb, rss_kb - initial_rss_kb);
+}
+
+int main(int argc, char *argv[]) {
+
+  struct dht_sim_settings settings;
+  dht_sim_default_settings(&settings);
+  long long num_reads = DEFAULT_NUM_READS;
+  long long report_every = DEFAULT_REPORT_EVERY;
+
+  int c;
+  while ((c = getopt(argc, argv, "hn:r:s:p:l:z:o:j:D:S:C:")) != -1)
+    switch (c)
+      {
+      case 'h':
+        show_help_and_exit();
+        break;
+      case 'n':
+        num_reads = convert_str_to_ll(optarg);
+        break;
+      case 'r':
+        report_every = convert_str_to_ll(optarg);
+        break;
+      case 's':
+        settings.seed = convert_str_to_ll(optarg);
+        break;
+      case 'p':
+        settings.ns_per_poll = convert_str_to_ll(optarg);
+        break;
+      case 'l':
+        settings.bit_low_ns = convert_str_to_ll(optarg) * 1000;
+        break;
+      case 'z':
+        settings.zero_high_ns = convert_str_to_ll(optarg) * 1000;
+        break;
+      case 'o':
+        settings.one_high_ns = convert_str_to_ll(optarg) * 1000;
+        break;
+      case 'j':
+        settings.jitter_ns = convert_str_to_ll(optarg) * 1000;
+        break;
+      case 'D':
+        settings.prob_dropped_edge = convert_str_to_probability(optarg);
+        break;
+      case 'S':
+        settings.prob_stuck_low = convert_str_to_probability(optarg);
+        break;
+      case 'C':
+        settings.prob_bad_checksum = convert_str_to_probability(optarg);
+        break;
+      case '?':
+        if (isprint (optopt))
+          fprintf (stderr, "Unknown option or missing argument `-%c'.\n",
+                   optopt);
+        exit(3);
+      default:
+        abort ();
+      }
+
+  if (settings.ns_per_poll == 0) {
+    fprintf(stderr, "ERROR: the virtual time of each GPIO read can't be 0.\n");
+    exit(4);
+  }
+  dht_sim_configure(&settings);
+
+  static struct latency_histogram hist;
+  struct soak_counters counters;
+  memset(&counters, 0, sizeof counters);
+
+  long initial_rss_kb = resident_set_kb();
+  uint64_t start_ns = now_ns();
+
+  for (long long read_idx = 0; read_idx < num_reads; read_idx++) {
+    float humidity = 0, temperature = 0;
+
+    uint64_t virtual_before = dht_sim_now_ns();
+    uint64_t before = now_ns();
+    int err_code = pi_2_dht_read(DHT22, settings.gpio_idx,
+                                 &humidity, &temperature);
+    histogram_record(&hist, now_ns() - before);
+    counters.virtual_ns += dht_sim_now_ns() - virtual_before;
+    counters.reads++;
+
+    const struct dht_sim_transaction * sent = dht_sim_last_transaction();
+    bool clean = (sent->faults == 0);
+    for (int fault = 0; fault < 3; fault++)
+      if (sent->faults & (1 << fault))
+        counters.faults[fault]++;
+
+    if (err_code == DHT_SUCCESS) {
+      if (humidity == sent->humidity && temperature == sent->temperature &&
+          ! (sent->faults & DHT_SIM_FAULT_BAD_CHECKSUM)) {
+        counters.success++;
+        if (clean)
+          counters.clean_success++;
+      } else {
+        counters.wrong_values++;
+      }
+    } else if (err_code == DHT_ERROR_TIMEOUT) {
+      counters.timeouts++;
+    } else if (err_code == DHT_ERROR_CHECKSUM) {
+      counters.checksum_errors++;
+    } else {
+      counters.other_errors++;
+      if (err_code == DHT_ERROR_GPIO) {
+        fprintf(stderr, "ERROR: couldn't map the simulated GPIO page.\n");
+        exit(5);
+      }
+    }
+    if (clean)
+      counters.clean_reads++;
+
+    if (report_every > 0 && counters.reads % report_every == 0)
+      report_progress(&counters, &hist, initial_rss_kb);
+  }
+
+  report_summary(&counters, &hist, initial_rss_kb, now_ns() - start_ns);
+
+  return counters.wrong_values == 0 ? 0 : 6;
+}
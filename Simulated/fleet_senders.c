@@ -0,0 +1,140 @@
+// Load generator for the fleet aggregator: it plays many samplers pushing
+// their fleet_protocol.h frames, each one with its own label set, to check
+// the aggregator on loopback without any Raspberry Pi.
+//
+// With "-m", it also sends a frame of each of the malformed label sets
+// below, which the aggregator must count in
+// dht22_aggregator_invalid_frames_total, and leave out of its page.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fleet_protocol.h"
+#include "net_sockets.h"
+
+static const char * const malformed_labels[] = {
+  "",                                  // no labels
+  "sampler=\"pi-x\"} injected_metric 1\n# {",
+  "sampler=\"pi-x\" site=\"lab\"",     // no comma
+  "sampler=\"pi-x\",",                 // trailing comma
+  "1sampler=\"pi-x\"",                 // bad names
+  "sam-pler=\"pi-x\"",
+  "sampler=pi-x",                      // unquoted value
+  "sampler=\"pi-x",                    // unterminated values
+  "sampler=\"pi-x\\\"",
+  "sampler=\"pi\\x\"",                 // unknown escape
+  "sampler=\"pi\nx\"",                 // raw newline
+};
+
+static void show_help_and_exit(void) {
+  printf(
+    "fleet_senders:\n"
+    "Push samples of many simulated samplers to a fleet aggregator.\n\n"
+    "   fleet_senders [-h] [-n senders] [-r rounds] [-i interval_ms] [-m]"
+      " host:port\n\n"
+    "     -n senders: number of samplers, i.e. of label sets (default: 1000).\n"
+    "     -r rounds: samples pushed by each sampler (default: 10).\n"
+    "     -i interval_ms: wait between rounds (default: 100).\n"
+    "     -m: also send a frame with each of some malformed label sets.\n"
+  );
+  exit(0);
+}
+
+static int convert_str_to_int(const char * str) {
+  char * num_end;
+  long value = strtol(str, &num_end, 0);
+  if (*num_end != '\0' || num_end == str || value < 0 || value > 1000000000) {
+    fprintf(stderr, "ERROR: It is not a proper number: '%s'\n", str);
+    exit(1);
+  }
+  return (int) value;
+}
+
+// Returns 1 if the frame couldn't be sent
+static int send_frame(int sock_fd, const struct fleet_sample * sample) {
+  uint8_t frame[FLEET_FRAME_MAX_SIZE];
+  size_t frame_len = fleet_frame_encode(frame, sizeof frame, sample);
+  while (send(sock_fd, frame, frame_len, 0) == -1) {
+    if (errno != ENOBUFS && errno != EAGAIN)
+      return 1;
+    usleep(100);
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+
+  int num_senders = 1000, num_rounds = 10, interval_ms = 100;
+  bool send_malformed = false;
+
+  int c;
+  while ((c = getopt(argc, argv, "hn:r:i:m")) != -1)
+    switch (c)
+      {
+      case 'h':
+        show_help_and_exit();
+        break;
+      case 'n':
+        num_senders = convert_str_to_int(optarg);
+        break;
+      case 'r':
+        num_rounds = convert_str_to_int(optarg);
+        break;
+      case 'i':
+        interval_ms = convert_str_to_int(optarg);
+        break;
+      case 'm':
+        send_malformed = true;
+        break;
+      default:
+        exit(2);
+      }
+  if (optind != argc - 1)
+    show_help_and_exit();
+
+  int sock_fd = net_connect_udp(argv[optind]);
+  if (sock_fd == -1)
+    exit(3);
+
+  unsigned long long sent = 0, dropped = 0;
+  for (int round = 0; round < num_rounds; round++) {
+    for (int sender = 0; sender < num_senders; sender++) {
+      char labels[64];
+      int labels_len = snprintf(labels, sizeof labels,
+                                "sampler=\"pi-%05d\", site=\"lab\"", sender);
+      struct fleet_sample sample = {
+                            .flags = 0,
+                            .humidity_tenths = (sender * 7 + round) % 1001,
+                            .temperature_tenths = (sender + round) % 800 - 200,
+                            .labels = labels,
+                            .labels_len = labels_len
+                          };
+      dropped += send_frame(sock_fd, &sample);
+      sent++;
+    }
+    if (interval_ms > 0 && round + 1 < num_rounds)
+      usleep(interval_ms * 1000);
+  }
+  printf("frames sent: %llu (%llu failed)\n", sent, dropped);
+
+  if (send_malformed) {
+    int num_malformed = sizeof malformed_labels / sizeof malformed_labels[0];
+    dropped = 0;
+    for (int i = 0; i < num_malformed; i++) {
+      struct fleet_sample sample = {
+                            .labels = malformed_labels[i],
+                            .labels_len = strlen(malformed_labels[i])
+                          };
+      dropped += send_frame(sock_fd, &sample);
+    }
+    printf("malformed frames sent: %d (%llu failed)\n", num_malformed,
+           dropped);
+  }
+  return 0;
+}
@@ -0,0 +1,113 @@
+// Iteration rate of the tightest polling loop of pi_2_dht_read(), against a
+// memory-backed GPIO register page, with the pin given at run time and with
+// the pin fixed at compile time (PI_2_MMIO_FIXED_GPIO, i.e. 'make PIN=...').
+//
+// Each iteration of that loop is the time resolution with which the decoder
+// measures the width of a pulse: the faster the loop, the more counts apart
+// are the ~27 us '0' and the ~70 us '1' bits of the RHT03/DHT22.
+//
+// It also tells whether the longest pulse of a response, the 80 us of its
+// preamble, fits within DHT_MAXCOUNT iterations at each rate.
+//
+// The level register is kept high, so the loop only ends at the iteration
+// limit. (This build doesn't define PI_2_MMIO_SIMULATED: the accessors are
+// the plain loads of the real hardware build.)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+// without 'make PIN=...', compare against the default GPIO index
+#ifndef PI_2_MMIO_FIXED_GPIO
+#define PI_2_MMIO_FIXED_GPIO  17
+#endif
+
+#include "pi_2_dht_read.h"
+#include "pi_2_mmio.h"
+
+#define DEFAULT_ITERATIONS  200000000
+#define ROUNDS              5
+#define LONGEST_PULSE_NS    80000
+
+volatile uint32_t* pi_2_mmio_gpio = NULL;
+
+static double now_seconds(void) {
+  struct timespec curr_time;
+  clock_gettime(CLOCK_MONOTONIC, &curr_time);
+  return curr_time.tv_sec + curr_time.tv_nsec / 1e9;
+}
+
+// (both loops are the same as in pi_2_dht_read(), and noinline, so that the
+// compiler can't propagate the pin from the caller)
+__attribute__((noinline))
+static uint32_t poll_runtime_pin(int pin, uint32_t max_count) {
+  uint32_t count = 0;
+  while (pi_2_mmio_input(pin)) {
+    if (++count >= max_count)
+      break;
+  }
+  return count;
+}
+
+__attribute__((noinline))
+static uint32_t poll_fixed_pin(uint32_t max_count) {
+  uint32_t count = 0;
+  while (pi_2_mmio_fixed_input()) {
+    if (++count >= max_count)
+      break;
+  }
+  return count;
+}
+
+static double best_ns_per_iteration(int fixed, int pin, uint32_t iterations) {
+  double best = 0;
+  for (int round = 0; round < ROUNDS; round++) {
+    double start = now_seconds();
+    uint32_t count = fixed ? poll_fixed_pin(iterations)
+                           : poll_runtime_pin(pin, iterations);
+    double ns = (now_seconds() - start) * 1e9 / count;
+    if (round == 0 || ns < best)
+      best = ns;
+  }
+  return best;
+}
+
+int main(int argc, char *argv[]) {
+
+  uint32_t iterations = DEFAULT_ITERATIONS;
+  if (argc > 1)
+    iterations = strtoul(argv[1], NULL, 0);
+  if (iterations == 0) {
+    fprintf(stderr, "Usage: gpio_poll_bench [iterations]\n");
+    exit(1);
+  }
+
+  void * page = mmap(NULL, 4096, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (page == MAP_FAILED) {
+    perror("ERROR: mmap");
+    exit(2);
+  }
+  pi_2_mmio_gpio = (uint32_t*)page;
+  pi_2_mmio_gpio[13] = 0xFFFFFFFF;    // every line high
+
+  // read the pin from a volatile, so that it is really a run-time value
+  volatile int runtime_pin = PI_2_MMIO_FIXED_GPIO;
+
+  double runtime_ns = best_ns_per_iteration(0, runtime_pin, iterations);
+  double fixed_ns = best_ns_per_iteration(1, PI_2_MMIO_FIXED_GPIO, iterations);
+
+  printf("polling loop, run-time pin %d:     %.3f ns/iteration, "
+         "%.1f M iterations/s, %.0f counts per 27 us '0' bit\n",
+         runtime_pin, runtime_ns, 1e3 / runtime_ns, 27000 / runtime_ns);
+  printf("polling loop, compile-time pin %d: %.3f ns/iteration, "
+         "%.1f M iterations/s, %.0f counts per 27 us '0' bit\n",
+         PI_2_MMIO_FIXED_GPIO, fixed_ns, 1e3 / fixed_ns, 27000 / fixed_ns);
+  printf("speed-up: %.2fx\n", runtime_ns / fixed_ns);
+  printf("80 us pulse: %.0f counts with the run-time pin (limit %d), "
+         "%.0f with the compile-time pin (limit %d)\n",
+         LONGEST_PULSE_NS / runtime_ns, DHT_RUNTIME_PIN_MAXCOUNT,
+         LONGEST_PULSE_NS / fixed_ns, DHT_MAXCOUNT);
+  return 0;
+}
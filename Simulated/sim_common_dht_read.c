@@ -0,0 +1,23 @@
+// Replacement of common_dht_read.c for simulation builds.
+//
+// The delays advance the virtual clock of the simulated sensor instead of
+// sleeping or spinning, so that a soak run of millions of reads doesn't spend
+// half a second of wall-clock time in the preamble of each one. There is no
+// real-time scheduling to ask for either: the simulated waveform advances in
+// lock-step with the polls, and can't be preempted.
+#include "common_dht_read.h"
+#include "sim_dht_generator.h"
+
+void busy_wait_milliseconds(uint32_t millis) {
+  dht_sim_advance_ns((uint64_t)millis * 1000000);
+}
+
+void sleep_milliseconds(uint32_t millis) {
+  dht_sim_advance_ns((uint64_t)millis * 1000000);
+}
+
+void set_max_priority(void) {
+}
+
+void set_default_priority(void) {
+}
@@ -0,0 +1,288 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pi_2_mmio.h"
+#include "sim_dht_generator.h"
+
+// Word offsets in the BCM2836 GPIO register page (the same ones used by the
+// accessors in pi_2_mmio.h)
+#define GPSET0   7
+#define GPCLR0  10
+#define GPLEV0  13
+
+// The DHT22 datasheet asks for a start signal of at least 1 millisecond low
+#define START_SIGNAL_MIN_NS  1000000ULL
+
+#define DHT_DATA_BITS  40
+
+// response delay + preamble low and high + 40 bits of low and high + trailing
+// low pulse at the end of the frame
+#define MAX_SEGMENTS  (3 + 2 * DHT_DATA_BITS + 1)
+
+enum sensor_state {
+  SENSOR_IDLE,          // line pulled-up high, waiting for a start signal
+  SENSOR_RESPONDING     // playing "segments" since the virtual time "t0"
+};
+
+struct segment {
+  uint64_t end_ns;      // end of this segment, relative to "t0"
+  int level;
+};
+
+static struct {
+  bool configured;
+  struct dht_sim_settings settings;
+  uint64_t rng_state;
+
+  uint64_t now_ns;
+  bool was_output;          // whether the pin was an output in the last step
+  uint32_t output_latch;    // level the host drives when the pin is an output
+  bool low_signal_seen;     // whether the host is driving a start signal...
+  uint64_t low_since_ns;    // ... and since when
+
+  enum sensor_state state;
+  uint64_t t0_ns;
+  struct segment segments[MAX_SEGMENTS];
+  int num_segments;
+  int curr_segment;
+  int level_after_frame;    // high, unless the line got stuck low
+
+  uint64_t num_transactions;
+  struct dht_sim_transaction last;
+  bool have_held_values;    // the values repeated with "hold_values"
+  int held_humidity;
+  int held_temperature;
+} sim;
+
+static uint64_t next_random(void) {
+  // xorshift64*: cheap, and good enough to choose values and faults
+  uint64_t x = sim.rng_state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  sim.rng_state = x;
+  return x * 0x2545F4914F6CDD1DULL;
+}
+
+static bool random_event(double probability) {
+  if (probability <= 0.0)
+    return false;
+  return (next_random() >> 11) * (1.0 / 9007199254740992.0) < probability;
+}
+
+// (a build for a fixed pin, 'make PIN=n', can only poll that one)
+#ifdef PI_2_MMIO_FIXED_GPIO
+#define DEFAULT_SIM_GPIO_IDX  PI_2_MMIO_FIXED_GPIO
+#else
+#define DEFAULT_SIM_GPIO_IDX  17
+#endif
+
+void dht_sim_default_settings(struct dht_sim_settings * settings) {
+  *settings = (struct dht_sim_settings) {
+                .gpio_idx = DEFAULT_SIM_GPIO_IDX,
+                .ns_per_poll = 100,
+                .response_delay_ns = 30000,
+                .preamble_low_ns = 80000,
+                .preamble_high_ns = 80000,
+                .bit_low_ns = 50000,
+                .zero_high_ns = 27000,
+                .one_high_ns = 70000,
+                .jitter_ns = 0,
+                .prob_dropped_edge = 0.0,
+                .prob_stuck_low = 0.0,
+                .prob_bad_checksum = 0.0,
+                .hold_values = false,
+                .seed = 1
+              };
+}
+
+void dht_sim_configure(const struct dht_sim_settings * settings) {
+  sim.configured = true;
+  sim.settings = *settings;
+  // xorshift must not start from zero
+  sim.rng_state = settings->seed ? settings->seed : 0x9E3779B97F4A7C15ULL;
+  sim.state = SENSOR_IDLE;
+  sim.have_held_values = false;
+}
+
+void dht_sim_get_settings(struct dht_sim_settings * settings) {
+  *settings = sim.settings;
+}
+
+void dht_sim_attach(void) {
+  if (! sim.configured) {
+    struct dht_sim_settings defaults;
+    dht_sim_default_settings(&defaults);
+    dht_sim_configure(&defaults);
+  }
+  // the line idles high, through the pull-up resistor
+  pi_2_mmio_gpio[GPLEV0] |= 1u << sim.settings.gpio_idx;
+}
+
+static void add_segment(uint64_t * elapsed_ns, uint32_t width_ns, int level) {
+  uint32_t jitter = sim.settings.jitter_ns;
+  int64_t width = width_ns;
+  if (jitter > 0) {
+    width += (int64_t)(next_random() % (2 * (uint64_t)jitter + 1)) - jitter;
+    if (width < (int64_t)sim.settings.ns_per_poll)
+      width = sim.settings.ns_per_poll;
+  }
+  *elapsed_ns += width;
+  sim.segments[sim.num_segments].end_ns = *elapsed_ns;
+  sim.segments[sim.num_segments].level = level;
+  sim.num_segments++;
+}
+
+static void start_transaction(void) {
+  const struct dht_sim_settings * cfg = &sim.settings;
+  struct dht_sim_transaction * frame = &sim.last;
+
+  // A random sample within the DHT22 ranges: 0 to 100 % relative humidity,
+  // and -40 to 80 Celsius, both in tenths.
+  // (or the first one again, for a stable room)
+  int humidity = next_random() % 1001;
+  int temperature = (int)(next_random() % 1201) - 400;
+  if (cfg->hold_values) {
+    if (! sim.have_held_values) {
+      sim.have_held_values = true;
+      sim.held_humidity = humidity;
+      sim.held_temperature = temperature;
+    }
+    humidity = sim.held_humidity;
+    temperature = sim.held_temperature;
+  }
+  int abs_temperature = temperature < 0 ? -temperature : temperature;
+
+  frame->data[0] = humidity >> 8;
+  frame->data[1] = humidity & 0xFF;
+  frame->data[2] = (abs_temperature >> 8) | (temperature < 0 ? 0x80 : 0);
+  frame->data[3] = abs_temperature & 0xFF;
+  frame->data[4] = (frame->data[0] + frame->data[1] +
+                    frame->data[2] + frame->data[3]) & 0xFF;
+  frame->humidity = humidity / 10.0f;
+  frame->temperature = abs_temperature / 10.0f;
+  if (temperature < 0)
+    frame->temperature *= -1.0f;
+
+  frame->faults = 0;
+  if (random_event(cfg->prob_bad_checksum)) {
+    frame->faults |= DHT_SIM_FAULT_BAD_CHECKSUM;
+    frame->data[4] ^= 1 + next_random() % 255;
+  }
+
+  uint64_t elapsed = 0;
+  sim.num_segments = 0;
+  sim.level_after_frame = 1;
+  add_segment(&elapsed, cfg->response_delay_ns, 1);
+
+  if (random_event(cfg->prob_stuck_low)) {
+    // The sensor pulls the line low, and never releases it
+    frame->faults |= DHT_SIM_FAULT_STUCK_LOW;
+    sim.level_after_frame = 0;
+  } else {
+    add_segment(&elapsed, cfg->preamble_low_ns, 0);
+    add_segment(&elapsed, cfg->preamble_high_ns, 1);
+    for (int bit = 0; bit < DHT_DATA_BITS; bit++) {
+      int value = (frame->data[bit / 8] >> (7 - bit % 8)) & 1;
+      add_segment(&elapsed, cfg->bit_low_ns, 0);
+      add_segment(&elapsed, value ? cfg->one_high_ns : cfg->zero_high_ns, 1);
+    }
+    add_segment(&elapsed, cfg->bit_low_ns, 0);
+
+    if (random_event(cfg->prob_dropped_edge)) {
+      // The host misses one whole pulse: it doesn't see the line toggle at
+      // either of the two edges of a pulse inside the frame.
+      frame->faults |= DHT_SIM_FAULT_DROPPED_EDGE;
+      int lost = 2 + next_random() % (sim.num_segments - 3);
+      sim.segments[lost].level = sim.segments[lost - 1].level;
+    }
+  }
+
+  sim.t0_ns = sim.now_ns;
+  sim.curr_segment = 0;
+  sim.state = SENSOR_RESPONDING;
+  sim.num_transactions++;
+}
+
+static int sensor_line_level(void) {
+  if (sim.state == SENSOR_IDLE)
+    return 1;
+
+  uint64_t elapsed = sim.now_ns - sim.t0_ns;
+  while (sim.curr_segment < sim.num_segments &&
+         elapsed >= sim.segments[sim.curr_segment].end_ns)
+    sim.curr_segment++;
+
+  if (sim.curr_segment == sim.num_segments) {
+    if (sim.level_after_frame)
+      sim.state = SENSOR_IDLE;
+    return sim.level_after_frame;
+  }
+  return sim.segments[sim.curr_segment].level;
+}
+
+void dht_sim_advance_ns(uint64_t ns) {
+  volatile uint32_t * gpio = pi_2_mmio_gpio;
+  if (gpio == NULL) {
+    sim.now_ns += ns;
+    return;
+  }
+
+  const int pin = sim.settings.gpio_idx;
+  const uint32_t mask = 1u << pin;
+
+  // GPSET0/GPCLR0 are write-only in the hardware: consume what the host
+  // wrote into them since the last step into the output latch.
+  if (gpio[GPSET0] & mask) {
+    sim.output_latch = 1;
+    gpio[GPSET0] &= ~mask;
+  }
+  if (gpio[GPCLR0] & mask) {
+    sim.output_latch = 0;
+    gpio[GPCLR0] &= ~mask;
+  }
+
+  bool is_output = ((gpio[pin / 10] >> ((pin % 10) * 3)) & 7) == 1;
+  if (is_output) {
+    // The host drives the line: any response in progress is cut short
+    sim.state = SENSOR_IDLE;
+    if (sim.output_latch) {
+      sim.low_signal_seen = false;
+    } else if (! sim.low_signal_seen) {
+      sim.low_signal_seen = true;
+      sim.low_since_ns = sim.now_ns;
+    }
+  } else if (sim.was_output) {
+    // The host released the line: answer if it was a valid start signal
+    if (sim.low_signal_seen &&
+        sim.now_ns - sim.low_since_ns >= START_SIGNAL_MIN_NS)
+      start_transaction();
+    sim.low_signal_seen = false;
+  }
+  sim.was_output = is_output;
+
+  sim.now_ns += ns;
+
+  int level = is_output ? (int)sim.output_latch : sensor_line_level();
+  if (level)
+    gpio[GPLEV0] |= mask;
+  else
+    gpio[GPLEV0] &= ~mask;
+}
+
+void dht_sim_poll(void) {
+  dht_sim_advance_ns(sim.settings.ns_per_poll);
+}
+
+uint64_t dht_sim_now_ns(void) {
+  return sim.now_ns;
+}
+
+uint64_t dht_sim_num_transactions(void) {
+  return sim.num_transactions;
+}
+
+const struct dht_sim_transaction * dht_sim_last_transaction(void) {
+  return &sim.last;
+}
@@ -0,0 +1,76 @@
+// Simulated RHT03/DHT22 sensor driving a memory-backed GPIO register page.
+//
+// The simulation replaces the /dev/gpiomem mapping behind pi_2_mmio_gpio with
+// an anonymous memory page, and a waveform generator that plays the role of
+// the sensor on that page: it watches the function-select and set/clear
+// registers written by the host, answers a valid start signal with a DHT22
+// response frame in the level register, and can inject faults into it.
+//
+// Time is virtual: every GPIO level read (pi_2_mmio_sim_tick()) and every
+// delay in the simulated common_dht_read advances a nanosecond clock, so runs
+// are deterministic for a given seed and don't depend on how many CPUs the
+// machine running the simulation has.
+#ifndef SIM_DHT_GENERATOR_H
+#define SIM_DHT_GENERATOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Faults injected into a simulated response (bit-mask)
+#define DHT_SIM_FAULT_DROPPED_EDGE   0x1
+#define DHT_SIM_FAULT_STUCK_LOW      0x2
+#define DHT_SIM_FAULT_BAD_CHECKSUM   0x4
+
+struct dht_sim_settings {
+  int gpio_idx;                  // GPIO index the simulated sensor is wired to
+  uint32_t ns_per_poll;          // virtual time taken by each GPIO level read
+  uint32_t response_delay_ns;    // line kept high after the host releases it
+  uint32_t preamble_low_ns;      // sensor's response: low ...
+  uint32_t preamble_high_ns;     // ... and high, before the data bits
+  uint32_t bit_low_ns;           // low pulse preceding each data bit
+  uint32_t zero_high_ns;         // high pulse of a '0' data bit
+  uint32_t one_high_ns;          // high pulse of a '1' data bit
+  uint32_t jitter_ns;            // max +/- jitter added to every pulse width
+  double prob_dropped_edge;      // probability of losing one pulse in a frame
+  double prob_stuck_low;         // probability of the line staying low
+  double prob_bad_checksum;      // probability of a corrupted checksum byte
+  bool hold_values;              // send the values of the first frame again
+  uint64_t seed;                 // seed of the fault and value generator
+};
+
+// What the simulated sensor sent in answer to the last start signal
+struct dht_sim_transaction {
+  uint8_t data[5];
+  float humidity;                // values as pi_2_dht_read() should decode them
+  float temperature;
+  unsigned faults;               // DHT_SIM_FAULT_* injected into this frame
+};
+
+// Fill "settings" with the nominal timings of the DHT22 datasheet, a poll
+// rate close to a Raspberry Pi 2's, and no faults.
+void dht_sim_default_settings(struct dht_sim_settings * settings);
+
+// Use "settings" for the following transactions (and reseed the generator).
+void dht_sim_configure(const struct dht_sim_settings * settings);
+
+// Settings currently in use by the simulated sensor.
+void dht_sim_get_settings(struct dht_sim_settings * settings);
+
+// Connect the sensor to the (just mapped) pi_2_mmio_gpio page, with the
+// default settings if dht_sim_configure() hasn't been called before.
+void dht_sim_attach(void);
+
+// Advance the virtual clock by "ns" nanoseconds, updating the line level.
+void dht_sim_advance_ns(uint64_t ns);
+
+// Advance the virtual clock by the time taken by one GPIO level read.
+void dht_sim_poll(void);
+
+// Current value of the virtual clock, in nanoseconds.
+uint64_t dht_sim_now_ns(void);
+
+// Number of start signals answered so far, and the last answer sent.
+uint64_t dht_sim_num_transactions(void);
+const struct dht_sim_transaction * dht_sim_last_transaction(void);
+
+#endif
@@ -0,0 +1,29 @@
+// Memory-backed replacement of Raspberry_Pi_2/pi_2_mmio.c for simulation
+// builds: the GPIO register page is an anonymous mapping driven by the
+// simulated RHT03/DHT22 sensor in sim_dht_generator.c.
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "pi_2_mmio.h"
+#include "sim_dht_generator.h"
+
+#define GPIO_LENGTH 4096
+
+volatile uint32_t* pi_2_mmio_gpio = NULL;
+
+int pi_2_mmio_init(void) {
+  if (pi_2_mmio_gpio == NULL) {
+    void * page = mmap(NULL, GPIO_LENGTH, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED) {
+      return MMIO_ERROR_MMAP;
+    }
+    pi_2_mmio_gpio = (uint32_t*)page;
+    dht_sim_attach();
+  }
+  return MMIO_SUCCESS;
+}
+
+void pi_2_mmio_sim_tick(void) {
+  dht_sim_poll();
+}
@@ -0,0 +1,185 @@
+// Check of the UDP output of the sampler ('make udp_check'): it runs the
+// simulated sampler with "-u" to a UDP socket of its own on loopback, and
+// checks every line received, in InfluxDB line protocol and in StatsD, with
+// a label whose value needs escaping.
+//
+// With a batch larger than the samples of a run, nothing may arrive until
+// the sampler is sent SIGTERM, and then all of its samples must.
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUN_MS          4500      // the samples at 1 and 3 seconds
+#define DRAIN_MS        1000
+#define LABEL           "room=\"lab 1\""
+
+struct check_run {
+  const char * format;
+  const char * batch_samples;
+  bool expect_before_sigterm;
+};
+
+struct run_counts {
+  int lines_before_sigterm;
+  int lines_after_sigterm;
+  int bad_lines;
+};
+
+static bool valid_influx_line(const char * line) {
+  float humidity, temperature;
+  unsigned long long epoch_nanosec;
+  int end = -1;
+  sscanf(line, "dht22,room=lab\\ 1 relat_humidity=%f,"
+               "temperature_celsius=%f %llu%n",
+         &humidity, &temperature, &epoch_nanosec, &end);
+  // (a timestamp in ns after 2001)
+  return end == (int)strlen(line) && humidity >= 0 && humidity <= 100 &&
+         epoch_nanosec > 1000000000000000000ULL;
+}
+
+static bool valid_statsd_line(const char * line) {
+  const char * metrics[] = { "dht22_relat_humidity",
+                             "dht22_temperature_celsius" };
+  for (int i = 0; i < 2; i++) {
+    size_t metric_len = strlen(metrics[i]);
+    if (strncmp(line, metrics[i], metric_len) != 0)
+      continue;
+    float value;
+    int end = -1;
+    sscanf(line + metric_len, ",room=lab_1:%f|g%n", &value, &end);
+    return end == (int)strlen(line + metric_len);
+  }
+  return false;
+}
+
+// Receive the datagrams for "timeout_ms", and check their lines
+static void receive_lines(int sock_fd, const char * format, int timeout_ms,
+                          int * lines, int * bad_lines) {
+
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (;;) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int elapsed_ms = (now.tv_sec - start.tv_sec) * 1000 +
+                     (now.tv_nsec - start.tv_nsec) / 1000000;
+    struct pollfd pollfd = { .fd = sock_fd, .events = POLLIN };
+    if (elapsed_ms >= timeout_ms ||
+        poll(&pollfd, 1, timeout_ms - elapsed_ms) <= 0)
+      return;
+
+    char datagram[2048];
+    ssize_t len = recv(sock_fd, datagram, sizeof datagram - 1, 0);
+    if (len <= 0)
+      continue;
+    datagram[len] = '\0';
+    for (char * line = strtok(datagram, "\n"); line != NULL;
+         line = strtok(NULL, "\n")) {
+      bool valid = strcmp(format, "influx") == 0 ? valid_influx_line(line) :
+                                                   valid_statsd_line(line);
+      if (! valid) {
+        printf("  bad line: '%s'\n", line);
+        (*bad_lines)++;
+      }
+      (*lines)++;
+    }
+  }
+}
+
+static void run_sampler(const char * sampler, const struct check_run * run,
+                        struct run_counts * counts) {
+
+  int sock_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  struct sockaddr_in addr = { .sin_family = AF_INET,
+                              .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+                              .sin_port = 0 };
+  socklen_t addr_len = sizeof addr;
+  if (sock_fd == -1 ||
+      bind(sock_fd, (struct sockaddr *)&addr, sizeof addr) == -1 ||
+      getsockname(sock_fd, (struct sockaddr *)&addr, &addr_len) == -1) {
+    perror("ERROR: while binding the UDP listener");
+    exit(3);
+  }
+  char target[32];
+  snprintf(target, sizeof target, "127.0.0.1:%d", ntohs(addr.sin_port));
+
+  char work_dir[] = "/tmp/udp_check.XXXXXX";
+  if (mkdtemp(work_dir) == NULL) {
+    perror("ERROR: mkdtemp");
+    exit(3);
+  }
+
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("ERROR: fork");
+    exit(3);
+  }
+  if (pid == 0) {
+    freopen("/dev/null", "w", stdout);
+    freopen("/dev/null", "w", stderr);
+    execl(sampler, sampler, "-w", "2", "-d", work_dir, "-u", target,
+          "-o", run->format, "-b", run->batch_samples, LABEL, (char *)NULL);
+    _exit(127);
+  }
+
+  memset(counts, 0, sizeof *counts);
+  receive_lines(sock_fd, run->format, RUN_MS, &counts->lines_before_sigterm,
+                &counts->bad_lines);
+  kill(pid, SIGTERM);
+  int status;
+  waitpid(pid, &status, 0);
+  receive_lines(sock_fd, run->format, DRAIN_MS, &counts->lines_after_sigterm,
+                &counts->bad_lines);
+  if (! WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    printf("  the sampler didn't exit cleanly on SIGTERM (status %d)\n",
+           status);
+    counts->bad_lines++;
+  }
+
+  close(sock_fd);
+  char textfile[64];
+  snprintf(textfile, sizeof textfile, "%s/dht22.prom", work_dir);
+  unlink(textfile);
+  rmdir(work_dir);
+}
+
+int main(int argc, char *argv[]) {
+
+  if (argc != 2) {
+    printf("udp_listener_check:\n"
+           "Check the UDP output of the simulated sampler on loopback.\n\n"
+           "   udp_listener_check path_to_rasppi_dht22_sampler_sim\n");
+    exit(argc == 1 ? 0 : 2);
+  }
+
+  const struct check_run runs[] = { { "influx", "1", true },
+                                    { "statsd", "1", true },
+                                    { "influx", "100", false },
+                                    { "statsd", "100", false } };
+  int failed_runs = 0;
+  for (int i = 0; i < sizeof runs / sizeof runs[0]; i++) {
+    struct run_counts counts;
+    run_sampler(argv[1], &runs[i], &counts);
+    int total_lines = counts.lines_before_sigterm + counts.lines_after_sigterm;
+    bool failed = (counts.bad_lines > 0 || total_lines == 0 ||
+                   (runs[i].expect_before_sigterm ?
+                      counts.lines_before_sigterm == 0 :
+                      counts.lines_before_sigterm > 0));
+    printf("%-6s batch %-3s: %d lines before SIGTERM, %d after, %d bad: %s\n",
+           runs[i].format, runs[i].batch_samples,
+           counts.lines_before_sigterm, counts.lines_after_sigterm,
+           counts.bad_lines, failed ? "FAILED" : "ok");
+    failed_runs += failed;
+  }
+  return failed_runs > 0 ? 6 : 0;
+}
@@ -0,0 +1,275 @@
+#define _GNU_SOURCE     // for O_TMPFILE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture_arbiter.h"
+
+#define ARBITER_MAGIC        0x44324152      // "D2AR"
+#define ARBITER_VERSION      1
+// where glibc's shm_open() keeps the segments
+#define ARBITER_SHM_DIR      "/dev/shm"
+#define ARBITER_OPEN_ATTEMPTS 3
+
+struct arbiter_segment {
+  uint32_t magic;             // set last, once the rest is initialized
+  uint32_t version;
+  pthread_mutex_t lock;       // robust and process-shared
+  pid_t slots[CAPTURE_ARBITER_SLOTS];     // 0: a free slot (under the lock)
+};
+
+struct capture_arbiter {
+  struct arbiter_segment * segment;
+  int slot;
+  unsigned long long wait_ns;
+  unsigned long long owner_deaths;
+};
+
+static void report_errno(const char * preffix_msg, const char * name) {
+  int old_errno = errno;
+  char err_msg[256];
+  strerror_r(old_errno, err_msg, sizeof err_msg);
+  fprintf(stderr, "%s '%s': %d: %s\n", preffix_msg, name, old_errno,
+          err_msg);
+}
+
+static unsigned long long monotonic_ns(void) {
+  struct timespec curr_time;
+  clock_gettime(CLOCK_MONOTONIC, &curr_time);
+  return (unsigned long long)curr_time.tv_sec * 1000000000 +
+         curr_time.tv_nsec;
+}
+
+// Lock the segment, recovering it from an owner that died with the lock.
+static int lock_segment(struct capture_arbiter * arbiter) {
+  int result = pthread_mutex_lock(&arbiter->segment->lock);
+  if (result == EOWNERDEAD) {
+    // it died in the middle of a capture: nothing in the segment needs
+    // repairing (its slot is reclaimed once its pid is gone)
+    arbiter->owner_deaths++;
+    result = pthread_mutex_consistent(&arbiter->segment->lock);
+  }
+  if (result != 0) {
+    fprintf(stderr, "ERROR: Could not lock the capture arbiter: %d\n",
+            result);
+    return -1;
+  }
+  return 0;
+}
+
+static int init_segment(struct arbiter_segment * segment) {
+  pthread_mutexattr_t attr;
+  if (pthread_mutexattr_init(&attr) != 0 ||
+      pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) != 0 ||
+      pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST) != 0 ||
+      pthread_mutex_init(&segment->lock, &attr) != 0)
+    return -1;
+  pthread_mutexattr_destroy(&attr);
+  segment->version = ARBITER_VERSION;
+  __atomic_store_n(&segment->magic, ARBITER_MAGIC, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// Create and initialize a segment without a name, and only then link it
+// into place: whoever opens "shm_name" finds a ready one, and a creator
+// killed midway leaves nothing behind. "lost_race" tells whether another
+// process linked its own segment first.
+static struct arbiter_segment * create_segment(const char * shm_name,
+                                               bool * lost_race) {
+  *lost_race = false;
+  int fd = open(ARBITER_SHM_DIR, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (fd == -1) {
+    report_errno("ERROR: Could not create the capture arbiter", shm_name);
+    return NULL;
+  }
+
+  struct arbiter_segment * segment = MAP_FAILED;
+  if (ftruncate(fd, sizeof *segment) == 0)
+    segment = mmap(NULL, sizeof *segment, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+  if (segment == MAP_FAILED) {
+    report_errno("ERROR: Could not size the capture arbiter", shm_name);
+    close(fd);
+    return NULL;
+  }
+  if (init_segment(segment) != 0) {
+    fprintf(stderr, "ERROR: Could not initialize the lock of the capture "
+                    "arbiter '%s'.\n", shm_name);
+    munmap(segment, sizeof *segment);
+    close(fd);
+    return NULL;
+  }
+
+  // (linkat() of the fd itself, with AT_EMPTY_PATH, needs privileges: its
+  // link in /proc doesn't)
+  char fd_path[32], shm_path[PATH_MAX];
+  snprintf(fd_path, sizeof fd_path, "/proc/self/fd/%d", fd);
+  snprintf(shm_path, sizeof shm_path, ARBITER_SHM_DIR "%s", shm_name);
+  int result = linkat(AT_FDCWD, fd_path, AT_FDCWD, shm_path,
+                      AT_SYMLINK_FOLLOW);
+  if (result == -1) {
+    *lost_race = (errno == EEXIST);
+    if (! *lost_race)
+      report_errno("ERROR: Could not link the capture arbiter", shm_name);
+    munmap(segment, sizeof *segment);
+    segment = NULL;
+  }
+  close(fd);
+  return segment;
+}
+
+static struct arbiter_segment * map_existing_segment(int fd,
+                                                     const char * shm_name) {
+  struct arbiter_segment * segment = NULL;
+  struct stat shm_stat;
+  if (fstat(fd, &shm_stat) == -1 ||
+      shm_stat.st_size < (off_t)sizeof *segment) {
+    fprintf(stderr, "ERROR: The capture arbiter '%s' is not of this version "
+                    "of the sampler.\n", shm_name);
+    close(fd);
+    return NULL;
+  }
+
+  segment = mmap(NULL, sizeof *segment, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fd, 0);
+  close(fd);
+  if (segment == MAP_FAILED) {
+    report_errno("ERROR: Could not map the capture arbiter", shm_name);
+    return NULL;
+  }
+  if (__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) != ARBITER_MAGIC ||
+      segment->version != ARBITER_VERSION) {
+    fprintf(stderr, "ERROR: The capture arbiter '%s' is not of this version "
+                    "of the sampler.\n", shm_name);
+    munmap(segment, sizeof *segment);
+    return NULL;
+  }
+  return segment;
+}
+
+static struct arbiter_segment * map_segment(const char * shm_name) {
+
+  // (again if another sampler linked its segment between the two steps)
+  for (int attempt = 0; attempt < ARBITER_OPEN_ATTEMPTS; attempt++) {
+    int fd = shm_open(shm_name, O_RDWR | O_CLOEXEC, 0600);
+    if (fd != -1)
+      return map_existing_segment(fd, shm_name);
+    if (errno != ENOENT) {
+      report_errno("ERROR: Could not open the capture arbiter", shm_name);
+      return NULL;
+    }
+    bool lost_race;
+    struct arbiter_segment * segment = create_segment(shm_name, &lost_race);
+    if (! lost_race)
+      return segment;
+  }
+  fprintf(stderr, "ERROR: Could not open the capture arbiter '%s'.\n",
+          shm_name);
+  return NULL;
+}
+
+static bool slot_is_free(pid_t pid) {
+  return pid == 0 || (kill(pid, 0) == -1 && errno == ESRCH);
+}
+
+struct capture_arbiter * capture_arbiter_open(const char * name,
+                                              int inherited_slot) {
+
+  char shm_name[NAME_MAX];
+  if (*name == '\0' || strchr(name, '/') != NULL ||
+      snprintf(shm_name, sizeof shm_name, CAPTURE_ARBITER_SHM_PREFIX "%s", name) >=
+        (int)sizeof shm_name) {
+    fprintf(stderr, "ERROR: '%s' is not a valid name for a capture "
+                    "arbiter.\n", name);
+    return NULL;
+  }
+
+  struct capture_arbiter * arbiter = calloc(1, sizeof *arbiter);
+  if (arbiter == NULL)
+    return NULL;
+  arbiter->segment = map_segment(shm_name);
+  if (arbiter->segment == NULL || lock_segment(arbiter) != 0) {
+    free(arbiter);
+    return NULL;
+  }
+
+  pid_t * slots = arbiter->segment->slots;
+  arbiter->slot = -1;
+  if (inherited_slot >= 0 && inherited_slot < CAPTURE_ARBITER_SLOTS) {
+    arbiter->slot = inherited_slot;
+  } else {
+    for (int slot = 0; slot < CAPTURE_ARBITER_SLOTS; slot++)
+      if (slot_is_free(slots[slot])) {
+        arbiter->slot = slot;
+        break;
+      }
+  }
+  if (arbiter->slot != -1)
+    slots[arbiter->slot] = getpid();
+  pthread_mutex_unlock(&arbiter->segment->lock);
+
+  if (arbiter->slot == -1) {
+    fprintf(stderr, "ERROR: The capture arbiter '%s' has already its %d "
+                    "samplers.\n", name, CAPTURE_ARBITER_SLOTS);
+    munmap(arbiter->segment, sizeof *arbiter->segment);
+    free(arbiter);
+    return NULL;
+  }
+  return arbiter;
+}
+
+void capture_arbiter_close(struct capture_arbiter * arbiter) {
+  if (lock_segment(arbiter) == 0) {
+    if (arbiter->segment->slots[arbiter->slot] == getpid())
+      arbiter->segment->slots[arbiter->slot] = 0;
+    pthread_mutex_unlock(&arbiter->segment->lock);
+  }
+  munmap(arbiter->segment, sizeof *arbiter->segment);
+  free(arbiter);
+}
+
+int capture_arbiter_slot(const struct capture_arbiter * arbiter) {
+  return arbiter->slot;
+}
+
+int capture_arbiter_acquire(struct capture_arbiter * arbiter) {
+
+  int result = pthread_mutex_trylock(&arbiter->segment->lock);
+  if (result == 0)
+    return 0;
+  if (result == EOWNERDEAD) {
+    arbiter->owner_deaths++;
+    return pthread_mutex_consistent(&arbiter->segment->lock) == 0 ? 0 : -1;
+  }
+
+  // another sampler is capturing: this process is still at its normal
+  // priority here, so it just sleeps in the futex until its turn
+  unsigned long long wait_start = monotonic_ns();
+  result = lock_segment(arbiter);
+  arbiter->wait_ns += monotonic_ns() - wait_start;
+  return result;
+}
+
+void capture_arbiter_release(struct capture_arbiter * arbiter) {
+  pthread_mutex_unlock(&arbiter->segment->lock);
+}
+
+double capture_arbiter_wait_seconds(const struct capture_arbiter * arbiter) {
+  return arbiter->wait_ns / 1e9;
+}
+
+unsigned long long capture_arbiter_owner_deaths(
+                                  const struct capture_arbiter * arbiter) {
+  return arbiter->owner_deaths;
+}
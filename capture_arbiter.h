@@ -0,0 +1,52 @@
+// Arbiter of the capture windows of several samplers running on the same
+// Raspberry Pi (on different GPIOs, or with different label sets).
+//
+// Each read of a sensor raises its process to the maximum SCHED_FIFO
+// priority and busy-waits: two of them at once make each other miss pulses,
+// and both reads fail. The samplers that open the same arbiter share a small
+// POSIX shared-memory segment with
+//
+//  - a robust, process-shared lock (a futex with glibc's robust-list support,
+//    so that a sampler killed in the middle of a read doesn't block the
+//    others), which serializes their capture windows;
+//  - a table of slots, one per sampler, whose index sets the offset of its
+//    samples into each period, so that they are spread across the period
+//    and seldom have to wait for each other.
+#ifndef CAPTURE_ARBITER_H
+#define CAPTURE_ARBITER_H
+
+// the shared-memory segment of the arbiter "name" is this prefix + "name"
+#define CAPTURE_ARBITER_SHM_PREFIX  "/rasppi_dht22_arbiter."
+#define CAPTURE_ARBITER_SLOTS     16
+// the offset between the samples of consecutive slots (a capture window,
+// with the sensor's 500 ms wake-up, is some 0.55 seconds long)
+#define CAPTURE_ARBITER_SLOT_MS   1000
+
+struct capture_arbiter;
+
+// Open, creating it if it doesn't exist, the arbiter "name" (a file name in
+// /dev/shm, without '/'), and claim the first free slot, or "inherited_slot"
+// if it isn't -1 (that of the previous process, after a handover). Returns
+// NULL (after printing the reason) on error.
+struct capture_arbiter * capture_arbiter_open(const char * name,
+                                              int inherited_slot);
+
+// Release the slot, and unmap the segment.
+void capture_arbiter_close(struct capture_arbiter * arbiter);
+
+int capture_arbiter_slot(const struct capture_arbiter * arbiter);
+
+// Wait for the capture window. Returns 0, or -1 (after printing the reason)
+// on error, in which case the caller captures without the arbiter.
+int capture_arbiter_acquire(struct capture_arbiter * arbiter);
+
+void capture_arbiter_release(struct capture_arbiter * arbiter);
+
+// Total time this process has waited in capture_arbiter_acquire()
+double capture_arbiter_wait_seconds(const struct capture_arbiter * arbiter);
+
+// Times this process took over the lock from a sampler that died with it
+unsigned long long capture_arbiter_owner_deaths(
+                                  const struct capture_arbiter * arbiter);
+
+#endif
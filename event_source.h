@@ -0,0 +1,56 @@
+// A file descriptor watched by an epoll(7) loop, together with the handler of
+// its events: the loops in this program keep a pointer to the event_source in
+// the epoll_event's data, and dispatch with
+//
+//     source->on_event(source, event.events);
+//
+// The owner of each kind of file descriptor embeds an event_source as the
+// first member of its own struct.
+#ifndef EVENT_SOURCE_H
+#define EVENT_SOURCE_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+
+#define EVENT_LOOP_MAX_EVENTS  64
+
+struct event_source {
+  int fd;
+  void (*on_event)(struct event_source * source, uint32_t events);
+};
+
+static inline int event_source_add(int epoll_fd, struct event_source * source,
+                                   uint32_t events) {
+  struct epoll_event event = { .events = events, .data.ptr = source };
+  return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, source->fd, &event);
+}
+
+static inline int event_source_modify(int epoll_fd,
+                                      struct event_source * source,
+                                      uint32_t events) {
+  struct epoll_event event = { .events = events, .data.ptr = source };
+  return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, source->fd, &event);
+}
+
+// Dispatch the events of "epoll_fd" to their sources, forever. It only
+// returns on error.
+static inline void event_loop_run(int epoll_fd) {
+  struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+  for (;;) {
+    int num_events = epoll_wait(epoll_fd, events, EVENT_LOOP_MAX_EVENTS, -1);
+    if (num_events == -1) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "ERROR: while calling epoll_wait(): %d\n", errno);
+      return;
+    }
+    for (int i = 0; i < num_events; i++) {
+      struct event_source * source = events[i].data.ptr;
+      source->on_event(source, events[i].events);
+    }
+  }
+}
+
+#endif
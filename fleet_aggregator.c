@@ -0,0 +1,339 @@
+#define _GNU_SOURCE     // for recvmmsg()
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event_source.h"
+#include "fleet_aggregator.h"
+#include "fleet_protocol.h"
+#include "metrics_http.h"
+#include "net_sockets.h"
+
+#define INITIAL_TABLE_CAPACITY   1024      // must be a power of 2
+#define RECV_BATCH               64
+// a whole fleet pushing at the same tick arrives as a burst
+#define RECV_BUFFER_BYTES        (4 * 1024 * 1024)
+
+// The latest sample of a label set
+struct fleet_series {
+  uint64_t hash;
+  char * labels;                // NULL: empty slot
+  uint16_t labels_len;
+  uint8_t flags;
+  int16_t humidity_tenths;
+  int16_t temperature_tenths;
+  time_t updated_at;            // CLOCK_MONOTONIC seconds
+};
+
+// Open addressing with linear probing, kept under 70 % of load, and with at
+// most FLEET_MAX_SERIES series. Stale series are left out of the page, and
+// reclaimed (by backward-shift deletion, so that no probe sequence gets
+// broken) when the table is about to grow or is full.
+struct fleet_table {
+  struct fleet_series * slots;
+  size_t capacity;
+  size_t used;
+  time_t reclaimed_at;          // at most one reclaim sweep per second
+};
+
+struct fleet_aggregator {
+  struct event_source receiver;
+  struct fleet_table table;
+  unsigned long long frames_received;
+  unsigned long long invalid_frames;
+  unsigned long long dropped_frames;
+  uint8_t buffers[RECV_BATCH][FLEET_FRAME_MAX_SIZE + 1];
+  struct iovec iovecs[RECV_BATCH];
+  struct mmsghdr messages[RECV_BATCH];
+};
+
+static time_t monotonic_seconds(void) {
+  struct timespec curr_time;
+  clock_gettime(CLOCK_MONOTONIC, &curr_time);
+  return curr_time.tv_sec;
+}
+
+static uint64_t hash_labels(const char * labels, size_t len) {
+  // FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (uint8_t)labels[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static int table_init(struct fleet_table * table, size_t capacity) {
+  table->slots = calloc(capacity, sizeof *table->slots);
+  table->capacity = capacity;
+  table->used = 0;
+  table->reclaimed_at = 0;
+  return table->slots == NULL ? -1 : 0;
+}
+
+static struct fleet_series * table_probe(struct fleet_table * table,
+                                         uint64_t hash, const char * labels,
+                                         uint16_t labels_len) {
+  size_t mask = table->capacity - 1;
+  for (size_t idx = hash & mask; ; idx = (idx + 1) & mask) {
+    struct fleet_series * slot = &table->slots[idx];
+    if (slot->labels == NULL ||
+        (slot->hash == hash && slot->labels_len == labels_len &&
+         memcmp(slot->labels, labels, labels_len) == 0))
+      return slot;
+  }
+}
+
+static int table_grow(struct fleet_table * table) {
+  struct fleet_table bigger;
+  if (table_init(&bigger, table->capacity * 2) != 0)
+    return -1;
+  for (size_t idx = 0; idx < table->capacity; idx++) {
+    struct fleet_series * old = &table->slots[idx];
+    if (old->labels != NULL)
+      *table_probe(&bigger, old->hash, old->labels, old->labels_len) = *old;
+  }
+  bigger.used = table->used;
+  bigger.reclaimed_at = table->reclaimed_at;
+  free(table->slots);
+  *table = bigger;
+  return 0;
+}
+
+// Empty the slot "idx", and shift back the series after it in its cluster
+// that can take its place (those whose home slot is not between "idx" and
+// their own slot)
+static void table_remove(struct fleet_table * table, size_t idx) {
+  size_t mask = table->capacity - 1;
+  free(table->slots[idx].labels);
+  for (size_t next = (idx + 1) & mask; table->slots[next].labels != NULL;
+       next = (next + 1) & mask) {
+    size_t home = table->slots[next].hash & mask;
+    if (((next - home) & mask) >= ((next - idx) & mask)) {
+      table->slots[idx] = table->slots[next];
+      idx = next;
+    }
+  }
+  memset(&table->slots[idx], 0, sizeof table->slots[idx]);
+  table->used--;
+}
+
+static void table_reclaim(struct fleet_table * table, time_t now) {
+  time_t oldest_fresh = now - FLEET_SAMPLE_TTL_SECONDS;
+  size_t mask = table->capacity - 1;
+  table->reclaimed_at = now;
+
+  // start after an empty slot (there is always one), so that no series is
+  // shifted back into the slots already swept
+  size_t start = 0;
+  while (table->slots[start].labels != NULL)
+    start++;
+  for (size_t swept = 0, idx = (start + 1) & mask; swept < table->capacity; ) {
+    struct fleet_series * slot = &table->slots[idx];
+    if (slot->labels != NULL && slot->updated_at < oldest_fresh) {
+      table_remove(table, idx);         // (and check what took its place)
+      continue;
+    }
+    swept++;
+    idx = (idx + 1) & mask;
+  }
+}
+
+// The series of "labels", or a new one. Returns NULL if it's a new one and
+// there is no room for it (see FLEET_MAX_SERIES), or no memory.
+static struct fleet_series * table_upsert(struct fleet_table * table,
+                                          const char * labels,
+                                          uint16_t labels_len, time_t now) {
+  uint64_t hash = hash_labels(labels, labels_len);
+  struct fleet_series * slot = table_probe(table, hash, labels, labels_len);
+  if (slot->labels != NULL)
+    return slot;
+
+  bool must_grow = (table->used + 1) * 10 > table->capacity * 7;
+  if ((must_grow || table->used >= FLEET_MAX_SERIES) &&
+      table->reclaimed_at != now) {
+    table_reclaim(table, now);
+    slot = table_probe(table, hash, labels, labels_len);
+    must_grow = (table->used + 1) * 10 > table->capacity * 7;
+  }
+  if (table->used >= FLEET_MAX_SERIES)
+    return NULL;
+  if (must_grow) {
+    if (table_grow(table) != 0)
+      return NULL;
+    slot = table_probe(table, hash, labels, labels_len);
+  }
+  // +1: an empty label set still needs a non-NULL "labels"
+  slot->labels = malloc(labels_len + 1);
+  if (slot->labels == NULL)
+    return NULL;
+  memcpy(slot->labels, labels, labels_len);
+  slot->labels_len = labels_len;
+  slot->hash = hash;
+  table->used++;
+  return slot;
+}
+
+static void on_frames(struct event_source * source, uint32_t events) {
+  struct fleet_aggregator * aggregator = (struct fleet_aggregator *)source;
+  time_t now = monotonic_seconds();
+
+  for (;;) {
+    int received = recvmmsg(source->fd, aggregator->messages, RECV_BATCH,
+                            MSG_DONTWAIT, NULL);
+    if (received == -1) {
+      if (errno == EINTR)
+        continue;
+      return;             // EAGAIN: all the pending frames were received
+    }
+
+    for (int i = 0; i < received; i++) {
+      struct mmsghdr * message = &aggregator->messages[i];
+      struct fleet_sample sample;
+      aggregator->frames_received++;
+      if ((message->msg_hdr.msg_flags & MSG_TRUNC) ||
+          fleet_frame_decode(aggregator->buffers[i], message->msg_len,
+                             &sample) != 0) {
+        aggregator->invalid_frames++;
+        continue;
+      }
+      struct fleet_series * series = table_upsert(&aggregator->table,
+                                                  sample.labels,
+                                                  sample.labels_len, now);
+      if (series == NULL) {
+        aggregator->dropped_frames++;
+        if (aggregator->table.used < FLEET_MAX_SERIES)
+          fprintf(stderr, "WARNING: Out of memory for a new label set.\n");
+        continue;
+      }
+      series->flags = sample.flags;
+      series->humidity_tenths = sample.humidity_tenths;
+      series->temperature_tenths = sample.temperature_tenths;
+      series->updated_at = now;
+    }
+    if (received < RECV_BATCH)
+      return;
+  }
+}
+
+// (fleet_frame_decode() only accepts well-formed label sets, so they can be
+// copied verbatim)
+static void print_series(FILE * output, const char * metric_name,
+                         const struct fleet_series * series, double value) {
+  fputs(metric_name, output);
+  if (series->labels_len > 0) {
+    fputc('{', output);
+    fwrite(series->labels, 1, series->labels_len, output);
+    fputc('}', output);
+  }
+  fprintf(output, " %.2f\n", value);
+}
+
+static void render_fleet_metrics(FILE * output, void * render_arg) {
+  struct fleet_aggregator * aggregator = render_arg;
+  const struct fleet_table * table = &aggregator->table;
+  time_t oldest_fresh = monotonic_seconds() - FLEET_SAMPLE_TTL_SECONDS;
+  size_t fresh = 0, farenheit = 0;
+
+  // https://prometheus.io/docs/instrumenting/exposition_formats/#text-format-details
+  // (all the series of a metric go together after its TYPE and HELP lines)
+  fprintf(output, "# TYPE dht22_relat_humidity gauge\n"
+                  "# HELP dht22_relat_humidity Relative humidity percentage "
+                  "in the RHT03/DHT22 sensor\n");
+  for (size_t idx = 0; idx < table->capacity; idx++) {
+    const struct fleet_series * series = &table->slots[idx];
+    if (series->labels == NULL || series->updated_at < oldest_fresh)
+      continue;
+    fresh++;
+    if (series->flags & FLEET_FRAME_FLAG_FARENHEIT)
+      farenheit++;
+    print_series(output, "dht22_relat_humidity", series,
+                 series->humidity_tenths / 10.0);
+  }
+
+  for (int in_farenheit = 0; in_farenheit <= 1; in_farenheit++) {
+    size_t num_series = in_farenheit ? farenheit : fresh - farenheit;
+    if (num_series == 0)
+      continue;
+    const char * metric_name = in_farenheit ? "dht22_temperature_farenheit"
+                                            : "dht22_temperature_celsius";
+    fprintf(output, "# TYPE %1$s gauge\n"
+                    "# HELP %1$s Temperature in the RHT03/DHT22 sensor\n",
+                    metric_name);
+    for (size_t idx = 0; idx < table->capacity; idx++) {
+      const struct fleet_series * series = &table->slots[idx];
+      if (series->labels == NULL || series->updated_at < oldest_fresh ||
+          !(series->flags & FLEET_FRAME_FLAG_FARENHEIT) != !in_farenheit)
+        continue;
+      double celsius = series->temperature_tenths / 10.0;
+      print_series(output, metric_name, series,
+                   in_farenheit ? celsius * ( 9.0 / 5.0 ) + 32.0 : celsius);
+    }
+  }
+
+  fprintf(output, "# TYPE dht22_aggregator_frames_received_total counter\n"
+                  "# HELP dht22_aggregator_frames_received_total Sample frames "
+                  "received from the samplers\n"
+                  "dht22_aggregator_frames_received_total %llu\n"
+                  "# TYPE dht22_aggregator_invalid_frames_total counter\n"
+                  "# HELP dht22_aggregator_invalid_frames_total Frames "
+                  "discarded as invalid\n"
+                  "dht22_aggregator_invalid_frames_total %llu\n"
+                  "# TYPE dht22_aggregator_dropped_frames_total counter\n"
+                  "# HELP dht22_aggregator_dropped_frames_total Frames of new "
+                  "label sets discarded for lack of room (more than %d)\n"
+                  "dht22_aggregator_dropped_frames_total %llu\n"
+                  "# TYPE dht22_aggregator_series gauge\n"
+                  "# HELP dht22_aggregator_series Label sets with a sample "
+                  "fresher than %d seconds\n"
+                  "dht22_aggregator_series %zu\n",
+                  aggregator->frames_received, aggregator->invalid_frames,
+                  FLEET_MAX_SERIES, aggregator->dropped_frames,
+                  FLEET_SAMPLE_TTL_SECONDS, fresh);
+}
+
+void run_fleet_aggregator(const char * listen_addr) {
+
+  static struct fleet_aggregator aggregator;
+
+  if (table_init(&aggregator.table, INITIAL_TABLE_CAPACITY) != 0) {
+    fprintf(stderr, "ERROR: while allocating the fleet hash table\n");
+    return;
+  }
+  for (int i = 0; i < RECV_BATCH; i++) {
+    aggregator.iovecs[i].iov_base = aggregator.buffers[i];
+    aggregator.iovecs[i].iov_len = sizeof aggregator.buffers[i];
+    aggregator.messages[i].msg_hdr.msg_iov = &aggregator.iovecs[i];
+    aggregator.messages[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1) {
+    fprintf(stderr, "ERROR: while calling epoll_create1(): %d\n", errno);
+    return;
+  }
+
+  aggregator.receiver.fd = net_listen(listen_addr, SOCK_DGRAM);
+  aggregator.receiver.on_event = on_frames;
+  if (aggregator.receiver.fd == -1)
+    return;
+  int recv_buffer = RECV_BUFFER_BYTES;
+  setsockopt(aggregator.receiver.fd, SOL_SOCKET, SO_RCVBUF,
+             &recv_buffer, sizeof recv_buffer);
+  if (event_source_add(epoll_fd, &aggregator.receiver, EPOLLIN) == -1) {
+    fprintf(stderr, "ERROR: Could not watch the UDP receiver: %d\n", errno);
+    return;
+  }
+
+  if (metrics_http_create(listen_addr, epoll_fd, render_fleet_metrics,
+                          &aggregator) == NULL)
+    return;
+
+  event_loop_run(epoll_fd);
+}
@@ -0,0 +1,23 @@
+// Fleet aggregator mode: a single collector process for the samples of many
+// samplers, which push them as fleet_protocol.h frames over UDP.
+//
+// The aggregator keeps the latest sample of each label set in an
+// open-addressing hash table, and serves all of them in one Prometheus
+// "/metrics" page, so that Prometheus scrapes one target for the whole fleet
+// instead of one node-exporter per Raspberry Pi.
+#ifndef FLEET_AGGREGATOR_H
+#define FLEET_AGGREGATOR_H
+
+// Samples not refreshed in this time are left out of the "/metrics" page
+// (this is the same as Prometheus' own staleness period)
+#define FLEET_SAMPLE_TTL_SECONDS   300
+
+// Label sets kept at most: the frames of new ones beyond it are dropped,
+// until the stale ones are reclaimed
+#define FLEET_MAX_SERIES           16384
+
+// Receive the frames on the UDP port, and serve "/metrics" on the TCP port,
+// of "listen_addr" ("[host:]port"). It only returns on error.
+void run_fleet_aggregator(const char * listen_addr);
+
+#endif
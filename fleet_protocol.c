@@ -0,0 +1,107 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "fleet_protocol.h"
+
+static void put_u16(uint8_t * buf, uint16_t value) {
+  buf[0] = value >> 8;
+  buf[1] = value & 0xFF;
+}
+
+static uint16_t get_u16(const uint8_t * buf) {
+  return (uint16_t)(buf[0] << 8 | buf[1]);
+}
+
+static bool is_name_start(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+// A well-formed Prometheus label set: 'name="value"' pairs, separated by a
+// comma and optional spaces, with names matching [a-zA-Z_][a-zA-Z0-9_]* and
+// '\\', '\"' and '\n' as the only escapes in the values.
+static bool valid_label_set(const char * labels, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    if (i > 0) {
+      if (labels[i++] != ',')
+        return false;
+      while (i < len && labels[i] == ' ')
+        i++;
+    }
+    if (i >= len || ! is_name_start(labels[i]))
+      return false;
+    while (i < len && (is_name_start(labels[i]) ||
+                       (labels[i] >= '0' && labels[i] <= '9')))
+      i++;
+    if (i + 1 >= len || labels[i] != '=' || labels[i + 1] != '"')
+      return false;
+    for (i += 2; i < len && labels[i] != '"'; i++) {
+      if (labels[i] == '\n' || labels[i] == '\0')
+        return false;
+      if (labels[i] == '\\') {
+        i++;
+        if (i >= len ||
+            (labels[i] != '\\' && labels[i] != '"' && labels[i] != 'n'))
+          return false;
+      }
+    }
+    if (i >= len)
+      return false;           // unterminated value
+    i++;
+  }
+  return true;
+}
+
+size_t fleet_frame_encode(uint8_t * buf, size_t size,
+                          const struct fleet_sample * sample) {
+  size_t len = FLEET_FRAME_HEADER_SIZE + sample->labels_len;
+  if (len > size || sample->labels_len > FLEET_FRAME_MAX_LABELS_LEN)
+    return 0;
+
+  put_u16(buf, FLEET_FRAME_MAGIC);
+  buf[2] = FLEET_FRAME_VERSION;
+  buf[3] = sample->flags;
+  put_u16(buf + 4, (uint16_t)sample->humidity_tenths);
+  put_u16(buf + 6, (uint16_t)sample->temperature_tenths);
+  put_u16(buf + 8, sample->labels_len);
+  memcpy(buf + FLEET_FRAME_HEADER_SIZE, sample->labels, sample->labels_len);
+  return len;
+}
+
+int fleet_frame_decode(const uint8_t * buf, size_t len,
+                       struct fleet_sample * sample) {
+  if (len < FLEET_FRAME_HEADER_SIZE || get_u16(buf) != FLEET_FRAME_MAGIC ||
+      buf[2] != FLEET_FRAME_VERSION)
+    return -1;
+
+  sample->flags = buf[3];
+  sample->humidity_tenths = (int16_t)get_u16(buf + 4);
+  sample->temperature_tenths = (int16_t)get_u16(buf + 6);
+  sample->labels_len = get_u16(buf + 8);
+  sample->labels = (const char *)buf + FLEET_FRAME_HEADER_SIZE;
+  if (sample->labels_len > FLEET_FRAME_MAX_LABELS_LEN ||
+      FLEET_FRAME_HEADER_SIZE + sample->labels_len != len)
+    return -1;
+
+  // the label set is copied verbatim into the exposition page, and it is the
+  // key of the sampler's series: an empty one would be shared by them all
+  return (sample->labels_len > 0 &&
+          valid_label_set(sample->labels, sample->labels_len)) ? 0 : -1;
+}
+
+int fleet_join_labels(char * buf, size_t size,
+                      char * const * prometheus_labels,
+                      int num_prometheus_labels) {
+  size_t len = 0;
+  buf[0] = '\0';
+  for (int label_idx = 0; label_idx < num_prometheus_labels; label_idx++) {
+    const char * separator = (label_idx > 0) ? ", " : "";
+    size_t needed = strlen(separator) + strlen(prometheus_labels[label_idx]);
+    if (len + needed >= size)
+      return -1;
+    strcpy(buf + len, separator);
+    strcat(buf + len, prometheus_labels[label_idx]);
+    len += needed;
+  }
+  return len;
+}
@@ -0,0 +1,55 @@
+// Compact binary frames with the samples that the samplers of a fleet push
+// to a fleet aggregator (see fleet_aggregator.h), one frame per UDP datagram.
+//
+// All the integers are in network byte order:
+//
+//    offset  size
+//       0     2    magic: FLEET_FRAME_MAGIC
+//       2     1    version: FLEET_FRAME_VERSION
+//       3     1    flags: FLEET_FRAME_FLAG_*
+//       4     2    relative humidity, in tenths of percentage
+//       6     2    temperature, in tenths of Celsius degree (signed)
+//       8     2    length of the label set
+//      10          label set: 'label_name="label_value", ...' (not braced)
+#ifndef FLEET_PROTOCOL_H
+#define FLEET_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FLEET_FRAME_MAGIC            0x4432      // "D2"
+#define FLEET_FRAME_VERSION          1
+#define FLEET_FRAME_HEADER_SIZE      10
+#define FLEET_FRAME_MAX_LABELS_LEN   1024
+#define FLEET_FRAME_MAX_SIZE  (FLEET_FRAME_HEADER_SIZE + \
+                               FLEET_FRAME_MAX_LABELS_LEN)
+
+// the sampler reports the temperature in Farenheit (its '-f' option)
+#define FLEET_FRAME_FLAG_FARENHEIT   0x1
+
+struct fleet_sample {
+  uint8_t flags;
+  int16_t humidity_tenths;
+  int16_t temperature_tenths;
+  const char * labels;          // not NUL-terminated
+  uint16_t labels_len;
+};
+
+// Encode "sample" into "buf". Returns the length of the frame, or 0 if it
+// doesn't fit in "size" bytes.
+size_t fleet_frame_encode(uint8_t * buf, size_t size,
+                          const struct fleet_sample * sample);
+
+// Decode the frame in "buf" into "sample" (whose "labels" then point into
+// "buf"). Returns -1 if it is not a valid frame, or if its label set is empty
+// or not a well-formed Prometheus one.
+int fleet_frame_decode(const uint8_t * buf, size_t len,
+                       struct fleet_sample * sample);
+
+// Join the Prometheus 'label_name="label_value"' pairs into the label set of
+// a frame. Returns its length, or -1 if it is longer than "size" - 1.
+int fleet_join_labels(char * buf, size_t size,
+                      char * const * prometheus_labels,
+                      int num_prometheus_labels);
+
+#endif
@@ -0,0 +1,192 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "handover.h"
+
+#define HANDOVER_MAGIC     0x44324830      // "D2H0"
+#define HANDOVER_ACK_BYTE  'K'
+
+// Every handover message starts with this header: a successor that doesn't
+// know the state's layout (a different size) refuses it
+struct handover_header {
+  uint32_t magic;
+  uint32_t state_len;
+};
+
+static void report_errno(const char * preffix_msg) {
+  int old_errno = errno;
+  char err_msg[256];
+  strerror_r(old_errno, err_msg, sizeof err_msg);
+  fprintf(stderr, "%s: %d: %s\n", preffix_msg, old_errno, err_msg);
+}
+
+int handover_spawn_successor(const char * exe, char * const argv[],
+                             pid_t * successor_pid) {
+
+  // SOCK_SEQPACKET: the state and the file descriptors arrive in one message
+  int socks[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, socks) == -1) {
+    report_errno("ERROR: while calling socketpair() for the handover");
+    return -1;
+  }
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    report_errno("ERROR: while calling fork() for the handover");
+    close(socks[0]);
+    close(socks[1]);
+    return -1;
+  }
+
+  if (pid == 0) {
+    // only the successor's end of the pair survives the exec
+    char fd_str[16];
+    snprintf(fd_str, sizeof fd_str, "%d", socks[1]);
+    if (fcntl(socks[1], F_SETFD, 0) == -1 ||
+        setenv(HANDOVER_ENV_VAR, fd_str, 1) == -1) {
+      _exit(127);
+    }
+    execv(exe, argv);
+    report_errno("ERROR: while calling execv() for the handover");
+    _exit(127);
+  }
+
+  close(socks[1]);
+  *successor_pid = pid;
+  return socks[0];
+}
+
+int handover_send(int sock, const void * state, size_t state_len,
+                  const int * fds, int num_fds) {
+
+  if (num_fds > HANDOVER_MAX_FDS) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  struct handover_header header = { .magic = HANDOVER_MAGIC,
+                                    .state_len = state_len };
+  struct iovec iov[2] = { { .iov_base = &header, .iov_len = sizeof header },
+                          { .iov_base = (void *)state,
+                            .iov_len = state_len } };
+  union {
+    char buf[CMSG_SPACE(HANDOVER_MAX_FDS * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+
+  if (num_fds > 0) {
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(num_fds * sizeof(int));
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(num_fds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, num_fds * sizeof(int));
+  }
+
+  ssize_t sent;
+  do {
+    sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+  } while (sent == -1 && errno == EINTR);
+  return sent == (ssize_t)(sizeof header + state_len) ? 0 : -1;
+}
+
+int handover_wait_ack(int sock, int timeout_ms) {
+
+  struct pollfd pollfd = { .fd = sock, .events = POLLIN };
+  int ready;
+  do {
+    ready = poll(&pollfd, 1, timeout_ms);
+  } while (ready == -1 && errno == EINTR);
+  if (ready != 1)
+    return -1;      // (a timeout too: the successor is stuck somewhere)
+
+  char ack = 0;
+  return recv(sock, &ack, 1, 0) == 1 && ack == HANDOVER_ACK_BYTE ? 0 : -1;
+}
+
+int handover_inherited_socket(void) {
+
+  const char * fd_str = getenv(HANDOVER_ENV_VAR);
+  if (fd_str == NULL)
+    return -1;
+
+  char * num_end;
+  long sock = strtol(fd_str, &num_end, 10);
+  unsetenv(HANDOVER_ENV_VAR);
+  if (*num_end != '\0' || num_end == fd_str || sock < 0 || sock > INT32_MAX ||
+      fcntl(sock, F_SETFD, FD_CLOEXEC) == -1) {
+    fprintf(stderr, "ERROR: Invalid handover socket '%s'.\n", fd_str);
+    return -1;
+  }
+  return (int) sock;
+}
+
+int handover_receive(int sock, void * state, size_t state_len,
+                     int * fds, int max_fds) {
+
+  struct handover_header header;
+  // one byte more than expected: to notice a larger (unknown) state
+  char extra;
+  struct iovec iov[3] = { { .iov_base = &header, .iov_len = sizeof header },
+                          { .iov_base = state, .iov_len = state_len },
+                          { .iov_base = &extra, .iov_len = 1 } };
+  union {
+    char buf[CMSG_SPACE(HANDOVER_MAX_FDS * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 3,
+                        .msg_control = control.buf,
+                        .msg_controllen = sizeof control.buf };
+
+  ssize_t received;
+  do {
+    received = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (received == -1 && errno == EINTR);
+  if (received == -1) {
+    report_errno("ERROR: while receiving the handover");
+    return -1;
+  }
+
+  int num_fds = 0;
+  for (struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int * received_fds = (int *)CMSG_DATA(cmsg);
+    for (int i = 0; i < count; i++) {
+      if (num_fds < max_fds)
+        fds[num_fds++] = received_fds[i];
+      else
+        close(received_fds[i]);
+    }
+  }
+
+  if (received != (ssize_t)(sizeof header + state_len) ||
+      (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+      header.magic != HANDOVER_MAGIC || header.state_len != state_len) {
+    fprintf(stderr, "ERROR: The handover from the previous process is not "
+                    "understood by this version of the sampler.\n");
+    while (num_fds > 0)
+      close(fds[--num_fds]);
+    return -1;
+  }
+  return num_fds;
+}
+
+int handover_ack(int sock) {
+
+  char ack = HANDOVER_ACK_BYTE;
+  int result = send(sock, &ack, 1, MSG_NOSIGNAL) == 1 ? 0 : -1;
+  close(sock);
+  return result;
+}
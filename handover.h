@@ -0,0 +1,46 @@
+// Handover of the live state of the sampler to a new process of its binary,
+// for upgrades and restarts without a gap in the samples.
+//
+// The old process starts its successor with one end of a Unix socket pair,
+// whose descriptor number is in the environment variable HANDOVER_ENV_VAR,
+// and sends it, in a single message, an opaque state and its live file
+// descriptors (SCM_RIGHTS): the timerfd keeps its phase, and the listening
+// sockets their pending connections. The old process only exits once the
+// successor confirms that it took over; otherwise it keeps on sampling.
+#ifndef HANDOVER_H
+#define HANDOVER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define HANDOVER_ENV_VAR  "RASPPI_DHT22_HANDOVER_FD"
+#define HANDOVER_MAX_FDS  4
+
+// In the old process: start "exe" with "argv" as the successor. Returns the
+// socket connected to it, or -1 (after printing the reason) on error.
+int handover_spawn_successor(const char * exe, char * const argv[],
+                             pid_t * successor_pid);
+
+// Send "state" and the "fds" to the successor. Returns 0, or -1 on error.
+int handover_send(int sock, const void * state, size_t state_len,
+                  const int * fds, int num_fds);
+
+// Wait up to "timeout_ms" for the successor to confirm that it took over.
+// Returns 0 if it did, or -1 if it failed or closed the socket.
+int handover_wait_ack(int sock, int timeout_ms);
+
+// In the new process: the socket to the old process, or -1 if this process
+// wasn't started by a handover. (It removes HANDOVER_ENV_VAR from the
+// environment.)
+int handover_inherited_socket(void);
+
+// Receive the state, which must be exactly "state_len" bytes, and up to
+// "max_fds" file descriptors (close-on-exec). Returns the number of file
+// descriptors received, or -1 on error.
+int handover_receive(int sock, void * state, size_t state_len,
+                     int * fds, int max_fds);
+
+// Confirm to the old process that this one took over, and close the socket.
+int handover_ack(int sock);
+
+#endif
@@ -0,0 +1,279 @@
+#define _GNU_SOURCE     // for accept4()
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event_source.h"
+#include "metrics_http.h"
+#include "net_sockets.h"
+
+#define MAX_REQUEST_LEN           2048
+#define MAX_CONNECTIONS           64
+// to send the whole request, and then for each progress of the response
+#define CONNECTION_TIMEOUT_SECS   10
+
+struct http_connection;
+
+// The timerfd that closes the stale connections, armed while there are any
+struct connection_sweeper {
+  struct event_source timer;
+  struct metrics_http_server * server;
+};
+
+struct metrics_http_server {
+  struct event_source listener;
+  int epoll_fd;
+  metrics_http_render_fn render;
+  void * render_arg;
+  struct connection_sweeper sweeper;
+  struct http_connection * connections;
+  int num_connections;
+};
+
+struct http_connection {
+  struct event_source source;
+  struct metrics_http_server * server;
+  struct http_connection * prev;
+  struct http_connection * next;
+  time_t deadline;              // CLOCK_MONOTONIC seconds
+  size_t request_len;
+  char request[MAX_REQUEST_LEN];
+  char * response;              // NULL while the request is being read
+  size_t response_len;
+  size_t response_sent;
+};
+
+static time_t monotonic_seconds(void) {
+  struct timespec curr_time;
+  clock_gettime(CLOCK_MONOTONIC, &curr_time);
+  return curr_time.tv_sec;
+}
+
+static void arm_sweeper(struct metrics_http_server * server, bool armed) {
+  struct itimerspec period = { .it_interval.tv_sec = armed ? 1 : 0,
+                               .it_value.tv_sec = armed ? 1 : 0 };
+  timerfd_settime(server->sweeper.timer.fd, 0, &period, NULL);
+}
+
+static void close_connection(struct http_connection * conn) {
+  struct metrics_http_server * server = conn->server;
+  if (conn->prev != NULL)
+    conn->prev->next = conn->next;
+  else
+    server->connections = conn->next;
+  if (conn->next != NULL)
+    conn->next->prev = conn->prev;
+  if (--server->num_connections == 0)
+    arm_sweeper(server, false);
+
+  // closing the socket removes it from the epoll set too
+  close(conn->source.fd);
+  free(conn->response);
+  free(conn);
+}
+
+static char * build_response(struct metrics_http_server * server,
+                             const char * request, size_t * response_len) {
+  char * body = NULL;
+  size_t body_len = 0;
+  const char * status = "200 OK";
+
+  if (strncmp(request, "GET /metrics ", strlen("GET /metrics ")) == 0 ||
+      strncmp(request, "GET / ", strlen("GET / ")) == 0) {
+    FILE * page = open_memstream(&body, &body_len);
+    if (page == NULL)
+      return NULL;
+    server->render(page, server->render_arg);
+    fclose(page);
+  } else {
+    status = "404 Not Found";
+    body = strdup("Only /metrics is served here.\n");
+    if (body == NULL)
+      return NULL;
+    body_len = strlen(body);
+  }
+
+  char header[256];
+  int header_len = snprintf(header, sizeof header,
+                            "HTTP/1.0 %s\r\n"
+                            "Content-Type: text/plain; version=0.0.4\r\n"
+                            "Content-Length: %zu\r\n"
+                            "Connection: close\r\n"
+                            "\r\n", status, body_len);
+  char * response = malloc(header_len + body_len);
+  if (response != NULL) {
+    memcpy(response, header, header_len);
+    memcpy(response + header_len, body, body_len);
+    *response_len = header_len + body_len;
+  }
+  free(body);
+  return response;
+}
+
+static void on_connection_event(struct event_source * source,
+                                uint32_t events) {
+  struct http_connection * conn = (struct http_connection *)source;
+
+  if (events & (EPOLLERR | EPOLLHUP)) {
+    close_connection(conn);
+    return;
+  }
+
+  if (conn->response == NULL && (events & EPOLLIN)) {
+    ssize_t len = read(source->fd, conn->request + conn->request_len,
+                       MAX_REQUEST_LEN - 1 - conn->request_len);
+    if (len == -1 && (errno == EAGAIN || errno == EINTR))
+      return;
+    if (len <= 0) {
+      close_connection(conn);
+      return;
+    }
+    conn->request_len += len;
+    conn->request[conn->request_len] = '\0';
+    // wait for the whole header of the request, unless it is too long
+    if (strstr(conn->request, "\r\n\r\n") == NULL &&
+        strstr(conn->request, "\n\n") == NULL &&
+        conn->request_len < MAX_REQUEST_LEN - 1)
+      return;
+
+    conn->response = build_response(conn->server, conn->request,
+                                    &conn->response_len);
+    conn->deadline = monotonic_seconds() + CONNECTION_TIMEOUT_SECS;
+    if (conn->response == NULL ||
+        event_source_modify(conn->server->epoll_fd, source, EPOLLOUT) == -1) {
+      close_connection(conn);
+      return;
+    }
+  }
+
+  if (conn->response != NULL) {
+    while (conn->response_sent < conn->response_len) {
+      ssize_t len = send(source->fd, conn->response + conn->response_sent,
+                         conn->response_len - conn->response_sent,
+                         MSG_NOSIGNAL);
+      if (len == -1 && errno == EINTR)
+        continue;
+      if (len == -1 && errno == EAGAIN)
+        return;               // wait for the next EPOLLOUT
+      if (len == -1) {
+        close_connection(conn);
+        return;
+      }
+      conn->response_sent += len;
+      conn->deadline = monotonic_seconds() + CONNECTION_TIMEOUT_SECS;
+    }
+    close_connection(conn);
+  }
+}
+
+static void on_listener_event(struct event_source * source, uint32_t events) {
+  struct metrics_http_server * server = (struct metrics_http_server *)source;
+
+  for (;;) {
+    int conn_fd = accept4(source->fd, NULL, NULL,
+                          SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (conn_fd == -1) {
+      if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+        fprintf(stderr, "WARNING: Could not accept a /metrics scrape: %d\n",
+                errno);
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      return;
+    }
+
+    struct http_connection * conn = NULL;
+    if (server->num_connections < MAX_CONNECTIONS)
+      conn = calloc(1, sizeof *conn);
+    if (conn == NULL) {
+      close(conn_fd);
+      continue;
+    }
+    conn->source.fd = conn_fd;
+    conn->source.on_event = on_connection_event;
+    conn->server = server;
+    conn->deadline = monotonic_seconds() + CONNECTION_TIMEOUT_SECS;
+    conn->next = server->connections;
+    if (conn->next != NULL)
+      conn->next->prev = conn;
+    server->connections = conn;
+    if (server->num_connections++ == 0)
+      arm_sweeper(server, true);
+    if (event_source_add(server->epoll_fd, &conn->source, EPOLLIN) == -1)
+      close_connection(conn);
+  }
+}
+
+static void on_sweeper_event(struct event_source * source, uint32_t events) {
+  struct connection_sweeper * sweeper = (struct connection_sweeper *)source;
+  uint64_t expirations;
+  if (read(source->fd, &expirations, sizeof expirations) == -1)
+    return;
+
+  // The stale connections are only shut down: their own handler then gets
+  // an EPOLLHUP, and closes them, so that no event of this epoll_wait()
+  // batch is left pointing to a freed connection.
+  time_t now = monotonic_seconds();
+  for (struct http_connection * conn = sweeper->server->connections;
+       conn != NULL; conn = conn->next)
+    if (now >= conn->deadline)
+      shutdown(conn->source.fd, SHUT_RDWR);
+}
+
+struct metrics_http_server * metrics_http_create(const char * listen_addr,
+                                                 int epoll_fd,
+                                                 metrics_http_render_fn render,
+                                                 void * render_arg) {
+
+  int listen_fd = net_listen(listen_addr, SOCK_STREAM);
+  if (listen_fd == -1)
+    return NULL;
+
+  return metrics_http_create_on_socket(listen_fd, epoll_fd, render,
+                                       render_arg);
+}
+
+struct metrics_http_server * metrics_http_create_on_socket(
+                                                 int listen_fd,
+                                                 int epoll_fd,
+                                                 metrics_http_render_fn render,
+                                                 void * render_arg) {
+
+  struct metrics_http_server * server = calloc(1, sizeof *server);
+  if (server == NULL) {
+    close(listen_fd);
+    return NULL;
+  }
+  server->listener.fd = listen_fd;
+  server->listener.on_event = on_listener_event;
+  server->epoll_fd = epoll_fd;
+  server->render = render;
+  server->render_arg = render_arg;
+  server->sweeper.server = server;
+  server->sweeper.timer.on_event = on_sweeper_event;
+  server->sweeper.timer.fd = timerfd_create(CLOCK_MONOTONIC,
+                                            TFD_NONBLOCK | TFD_CLOEXEC);
+
+  if (server->sweeper.timer.fd == -1 ||
+      event_source_add(epoll_fd, &server->sweeper.timer, EPOLLIN) == -1 ||
+      event_source_add(epoll_fd, &server->listener, EPOLLIN) == -1) {
+    fprintf(stderr, "ERROR: Could not watch the /metrics listener: %d\n",
+            errno);
+    if (server->sweeper.timer.fd != -1)
+      close(server->sweeper.timer.fd);
+    close(listen_fd);
+    free(server);
+    return NULL;
+  }
+  return server;
+}
+
+int metrics_http_listen_fd(const struct metrics_http_server * server) {
+  return server->listener.fd;
+}
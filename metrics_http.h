@@ -0,0 +1,36 @@
+// A minimal HTTP/1.0 server of a Prometheus "/metrics" page, driven by the
+// caller's epoll(7) loop (see event_source.h).
+//
+// Each scrape renders the page anew through the "render" callback, into a
+// memory stream, and the response is written without blocking the loop:
+// slow scrapers just keep their connection waiting for EPOLLOUT. Connections
+// that don't send their request, or accept the response, within 10 seconds
+// are closed, and at most 64 are kept open at once.
+#ifndef METRICS_HTTP_H
+#define METRICS_HTTP_H
+
+#include <stdio.h>
+
+typedef void (*metrics_http_render_fn)(FILE * output, void * render_arg);
+
+struct metrics_http_server;
+
+// Listen on "listen_addr" ("[host:]port"), and register the listening socket
+// in "epoll_fd". Returns NULL (after printing the reason) on error.
+struct metrics_http_server * metrics_http_create(const char * listen_addr,
+                                                 int epoll_fd,
+                                                 metrics_http_render_fn render,
+                                                 void * render_arg);
+
+// The same, on an already listening, non-blocking socket (e.g., one handed
+// over by a previous process of the sampler).
+struct metrics_http_server * metrics_http_create_on_socket(
+                                                 int listen_fd,
+                                                 int epoll_fd,
+                                                 metrics_http_render_fn render,
+                                                 void * render_arg);
+
+// The listening socket of "server"
+int metrics_http_listen_fd(const struct metrics_http_server * server);
+
+#endif
@@ -0,0 +1,132 @@
+#include <errno.h>
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "net_sockets.h"
+
+static void report_errno(const char * preffix_msg, const char * address) {
+  int old_errno = errno;
+  char err_msg[256];
+  strerror_r(old_errno, err_msg, sizeof err_msg);
+  fprintf(stderr, "%s '%s': %d: %s\n", preffix_msg, address, old_errno,
+          err_msg);
+}
+
+// Split "address" into its "host" (empty if there is none) and "port".
+static int split_host_port(const char * address, bool host_required,
+                           char * host, size_t host_size,
+                           const char ** port) {
+  const char * colon = strrchr(address, ':');
+  const char * host_start = address;
+  const char * host_end = colon;
+
+  if (colon == NULL) {
+    host_end = host_start;    // just a port
+    *port = address;
+  } else {
+    *port = colon + 1;
+    // accept "[ipv6_address]:port" too
+    if (host_end - host_start >= 2 && *host_start == '[' &&
+        host_end[-1] == ']') {
+      host_start++;
+      host_end--;
+    }
+  }
+  if (**port == '\0' || (host_required && host_end == host_start) ||
+      host_end - host_start >= host_size) {
+    fprintf(stderr, "ERROR: '%s' is not a valid %s address.\n", address,
+            host_required ? "'host:port'" : "'[host:]port'");
+    return -1;
+  }
+  memcpy(host, host_start, host_end - host_start);
+  host[host_end - host_start] = '\0';
+  return 0;
+}
+
+int net_connect_udp(const char * target) {
+  char host[256];
+  const char * port;
+  if (split_host_port(target, true, host, sizeof host, &port) != 0)
+    return -1;
+
+  struct addrinfo hints, *addresses;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  int err = getaddrinfo(host, port, &hints, &addresses);
+  if (err != 0) {
+    fprintf(stderr, "ERROR: Could not resolve UDP destination '%s': %s\n",
+            target, gai_strerror(err));
+    return -1;
+  }
+
+  int sock_fd = -1;
+  for (struct addrinfo * addr = addresses; addr != NULL; addr = addr->ai_next) {
+    sock_fd = socket(addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC,
+                     addr->ai_protocol);
+    if (sock_fd == -1)
+      continue;
+    // a connected socket can send without giving a destination every time
+    if (connect(sock_fd, addr->ai_addr, addr->ai_addrlen) == 0)
+      break;
+    close(sock_fd);
+    sock_fd = -1;
+  }
+  freeaddrinfo(addresses);
+
+  if (sock_fd == -1)
+    report_errno("ERROR: Could not open UDP socket to", target);
+  return sock_fd;
+}
+
+int net_listen(const char * listen_addr, int socktype) {
+  char host[256];
+  const char * port;
+  if (split_host_port(listen_addr, false, host, sizeof host, &port) != 0)
+    return -1;
+
+  struct addrinfo hints, *addresses;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = socktype;
+  hints.ai_flags = AI_PASSIVE;
+  int err = getaddrinfo(host[0] ? host : NULL, port, &hints, &addresses);
+  if (err != 0) {
+    fprintf(stderr, "ERROR: Could not resolve listening address '%s': %s\n",
+            listen_addr, gai_strerror(err));
+    return -1;
+  }
+
+  // prefer IPv6, which (with IPV6_V6ONLY off by default) takes IPv4 too
+  struct addrinfo * chosen = addresses;
+  for (struct addrinfo * addr = addresses; addr != NULL; addr = addr->ai_next)
+    if (addr->ai_family == AF_INET6) {
+      chosen = addr;
+      break;
+    }
+
+  int sock_fd = socket(chosen->ai_family,
+                       chosen->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                       chosen->ai_protocol);
+  if (sock_fd != -1) {
+    int reuse = 1;
+    setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+    if (bind(sock_fd, chosen->ai_addr, chosen->ai_addrlen) == -1 ||
+        (socktype == SOCK_STREAM && listen(sock_fd, SOMAXCONN) == -1)) {
+      int old_errno = errno;
+      close(sock_fd);
+      errno = old_errno;
+      sock_fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+
+  if (sock_fd == -1)
+    report_errno("ERROR: Could not listen on", listen_addr);
+  return sock_fd;
+}
@@ -0,0 +1,17 @@
+// Helpers to open the network sockets of the sampler's outputs and of the
+// fleet aggregator. Addresses are "host:port" or "[ipv6_address]:port"; in
+// listening addresses the host is optional (":port" or "port" listen on all
+// the addresses).
+#ifndef NET_SOCKETS_H
+#define NET_SOCKETS_H
+
+// Open a UDP socket connected to "target". Returns the socket, or -1 (after
+// printing the reason) on error.
+int net_connect_udp(const char * target);
+
+// Open a non-blocking socket of "socktype" (SOCK_STREAM, already listening,
+// or SOCK_DGRAM) bound to "listen_addr". Returns the socket, or -1 (after
+// printing the reason) on error.
+int net_listen(const char * listen_addr, int socktype);
+
+#endif
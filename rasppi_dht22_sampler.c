@@ -4,18 +4,39 @@
 #include <errno.h>
 #include <limits.h>
 #include <linux/limits.h>
+#include <math.h>
+#include <poll.h>
 #include <regex.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <time.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
 #include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "Raspberry_Pi_2/pi_2_dht_read.h"
+#include "capture_arbiter.h"
 #include "common_dht_read.h"
+#include "event_source.h"
+#include "fleet_aggregator.h"
+#include "fleet_protocol.h"
+#include "handover.h"
+#include "metrics_http.h"
+#include "net_sockets.h"
+#include "rasppi_dht22_sampler.h"
+#include "textfile_ring.h"
+#include "udp_publisher.h"
+
+#ifdef PI_2_MMIO_SIMULATED
+#include "sim_dht_generator.h"
+#endif
 
 
 // The future release 0.16 of the Prometheus Node-Exporter (in Release
@@ -26,13 +47,6 @@
 // https://github.com/prometheus/node_exporter/pull/769
 #define PRINT_PROMETHEUS_TIMESTAMPS    false
 
-// Some defaults
-// The first one is a default GPIO index (for the mapping of GPIO indexes to
-// physical pin numbers see, e.g.,
-// https://www.raspberrypi.org/forums/viewtopic.php?t=196696 )
-#define DEFAULT_DHT_GPIO_IDX  17
-#define DEFAULT_WAIT_SECONDS  60
-
 #define MIN_GPIO_INDEX  0
 #define MAX_GPIO_INDEX  27
 
@@ -40,18 +54,11 @@
 // ( https://learn.adafruit.com/dht/overview )
 #define MIN_WAIT_SECONDS   2
 
-#define PROMETHEUS_TEXT_COLL_FILE  "dht22.prom"
-#define PROMETHEUS_TEXT_COLL_DIR  "/var/lib/node_exporter/textfile_collector"
-
-// The type specifying the configuration settings for this program
-struct configuration_settings {
-  int dht22_gpio_idx;
-  bool temperature_in_farenheit;
-  int wait_seconds;
-  char text_collector_fname[PATH_MAX+1];
-  char ** prometheus_labels;
-  int num_prometheus_labels;
-};
+// On this signal, the sampler hands its live state over to a new process of
+// its (possibly upgraded) binary, with the same command-line (handover.h)
+#define HANDOVER_SIGNAL           SIGUSR2
+#define HANDOVER_STATE_VERSION    4
+#define HANDOVER_ACK_TIMEOUT_MS   10000
 
 
 void show_help_and_exit(void) {
@@ -61,7 +68,13 @@ void show_help_and_exit(void) {
     "to the Prometheus monitoring system's text collector.\n\n"
     "Optional command-line arguments:\n"
     "   [-h] [-f] [-g gpio_idx] [-w wait_seconds] [-d directory]"
+      " [-u host:port [-o influx|statsd] [-b batch_samples]]"
+      " [-a host:port]"
+      " [-m [host:]port] [-s socket_path] [-t ttl_seconds]"
+      " [-c change_threshold [-P republish_seconds]]"
+      " [-x arbiter_name] [-i] [-F]"
       " [prometheus_label=\"value\"] ...\n"
+    "   or: -A [host:]port\n"
     "\n"
     "Explanation of the optional command-line arguments:\n\n"
     "     -h: show these help messages.\n"
@@ -72,6 +85,44 @@ void show_help_and_exit(void) {
                           "the sensor (default: %d seconds).\n"
     "     -d directory: directory where Prometheus' Text-Collector expects "
                           "the sample metric files to read (default: %s).\n"
+    "     -u host:port: also send the samples over UDP to this destination, "
+                          "e.g., to a Telegraf input (default: none).\n"
+    "     -o influx|statsd: format of the UDP output: InfluxDB line protocol "
+                          "or StatsD gauges (default: influx).\n"
+    "     -b batch_samples: samples to coalesce into the UDP datagrams sent "
+                          "at once (default: %d).\n"
+    "     -a host:port: also push the samples, as compact binary frames over "
+                          "UDP, to a fleet aggregator, with the Prometheus "
+                          "labels that identify this sampler there "
+                          "(default: none).\n"
+    "     -m [host:]port: on-demand mode: don't sample every wait_seconds, "
+                          "but only when a scrape of /metrics on this TCP "
+                          "port finds the last sample older than "
+                          "ttl_seconds.\n"
+    "     -s socket_path: on-demand mode: take a sample (if the last one is "
+                          "older than ttl_seconds) when a client connects to "
+                          "this Unix socket, and write it the metrics.\n"
+    "     -t ttl_seconds: in on-demand mode, the max age of the sample served "
+                          "(default: wait_seconds; minimum: %d seconds).\n"
+    "     -c change_threshold: adaptive mode: sample every %d seconds when "
+                          "the temperature or the humidity changes more than "
+                          "this between consecutive samples, and back off "
+                          "towards wait_seconds while they are stable.\n"
+    "     -P republish_seconds: in adaptive mode, don't rewrite unchanged "
+                          "samples, but at least every these seconds "
+                          "(default and minimum: wait_seconds).\n"
+    "     -x arbiter_name: take turns to read the sensor with the other "
+                          "samplers in this Raspberry Pi with the same "
+                          "arbiter_name, and spread the samples of all of "
+                          "them across the period (default: none).\n"
+    "     -i: write the textfile through io_uring, and report the time "
+                          "each write takes to complete (if io_uring is not "
+                          "available, the textfile is written as usual).\n"
+    "     -F: fsync() the textfile before renaming it into place.\n"
+    "     -A [host:]port: don't sample: run as a fleet aggregator, receiving "
+                          "the frames pushed by the samplers on this UDP port "
+                          "and serving all their samples in /metrics on this "
+                          "TCP port (no other option is accepted with it).\n"
     "     prometheus_label=\"value\"...: Prometheus label=\"value\" pairs "
                           "with which to tag the output (default: none).\n"
     "                                 (Note: Prometheus requires that the "
@@ -81,8 +132,14 @@ void show_help_and_exit(void) {
     "need to be given in the command-line argument.\n"
     "                                  Probably, in a sh- or bash- like "
     "shell, the whole label=\"value\" needs to be protected thus:\n"
-    "                                     'label=\"value\"'.)\n",
-    DEFAULT_DHT_GPIO_IDX, DEFAULT_WAIT_SECONDS, PROMETHEUS_TEXT_COLL_DIR
+    "                                     'label=\"value\"'.)\n"
+    "\n"
+    "On SIGUSR2, the sampler hands its live state over to a new process of "
+    "its binary, e.g., after an upgrade, without missing a sample. On "
+    "SIGTERM or SIGINT, it sends the samples still batched for UDP before "
+    "exiting.\n",
+    DEFAULT_DHT_GPIO_IDX, DEFAULT_WAIT_SECONDS, PROMETHEUS_TEXT_COLL_DIR,
+    DEFAULT_UDP_BATCH_SAMPLES, MIN_WAIT_SECONDS, MIN_WAIT_SECONDS
   );
   exit(0);
 }
@@ -108,6 +165,20 @@ int convert_str_to_int(const char * str) {
   return (int) value;
 }
 
+float convert_str_to_float(const char * str) {
+
+  char * num_end;
+  errno = 0;
+  float value = strtof(str, &num_end);
+
+  if (errno != 0 || num_end == str || *num_end != '\0') {
+    fprintf(stderr, "ERROR: It is not a proper number: '%s'\n", str);
+    exit(2);
+  }
+
+  return value;
+}
+
 void report_errno_and_exit(int exit_code, const char * preffix_msg) {
 
   int old_errno = errno;
@@ -199,8 +270,10 @@ void parse_command_line(int argc, char *const *argv,
                         struct configuration_settings * output_config) {
 
   int c;
+  bool options_given[UCHAR_MAX + 1] = { false };
 
-  while ((c = getopt(argc, argv, "hfg:w:d:")) != -1)
+  while ((c = getopt(argc, argv, "hfg:w:d:u:o:b:a:A:m:s:t:c:P:x:iF")) != -1) {
+    options_given[(unsigned char)c] = true;
     switch (c)
       {
       case 'h':
@@ -220,6 +293,15 @@ void parse_command_line(int argc, char *const *argv,
 			MIN_GPIO_INDEX, MAX_GPIO_INDEX);
                exit(10);
 	}
+#ifdef PI_2_MMIO_FIXED_GPIO
+        if (output_config->dht22_gpio_idx != PI_2_MMIO_FIXED_GPIO) {
+               fprintf (stderr,
+                        "ERROR: This program was compiled for GPIO index %d "
+                        "only (make PIN=%d).\n",
+                        PI_2_MMIO_FIXED_GPIO, PI_2_MMIO_FIXED_GPIO);
+               exit(30);
+        }
+#endif
         break;
       case 'w':
         output_config->wait_seconds = convert_str_to_int(optarg);
@@ -260,6 +342,82 @@ void parse_command_line(int argc, char *const *argv,
 		  "/" PROMETHEUS_TEXT_COLL_FILE,
 		  size_dir - 1);
         break;
+      case 'u':
+        output_config->udp_target = optarg;
+        break;
+      case 'o':
+        if (udp_publisher_parse_format(optarg,
+                                       &output_config->udp_format) != 0) {
+               fprintf (stderr,
+                        "ERROR: Invalid UDP output format '%s'. "
+                        "It should be 'influx' or 'statsd'.\n", optarg);
+               exit(16);
+        }
+        break;
+      case 'b':
+        output_config->udp_batch_samples = convert_str_to_int(optarg);
+        if (output_config->udp_batch_samples < 1) {
+               fprintf (stderr,
+                        "ERROR: Invalid UDP batch size '%d'. "
+                        "It should be at least 1 sample.\n",
+                        output_config->udp_batch_samples);
+               exit(17);
+        }
+        break;
+      case 'a':
+        output_config->fleet_target = optarg;
+        break;
+      case 'A':
+        output_config->aggregator_listen = optarg;
+        break;
+      case 'c':
+        output_config->change_threshold = convert_str_to_float(optarg);
+        if (! isfinite(output_config->change_threshold) ||
+            output_config->change_threshold <= 0) {
+               fprintf (stderr,
+                        "ERROR: Invalid change threshold '%s'. "
+                        "It should be a finite number greater than 0.\n",
+                        optarg);
+               exit(31);
+        }
+        break;
+      case 'P':
+        output_config->republish_seconds = convert_str_to_int(optarg);
+        if (output_config->republish_seconds < MIN_WAIT_SECONDS) {
+               fprintf (stderr,
+                        "ERROR: Invalid republish time '%d'. "
+                        "The minimum allowable value is %d seconds.\n",
+                        output_config->republish_seconds,
+                        MIN_WAIT_SECONDS);
+               exit(32);
+        }
+        break;
+      case 'x':
+        output_config->arbiter_name = optarg;
+        break;
+      case 'i':
+        output_config->textfile_uring = true;
+        break;
+      case 'F':
+        output_config->textfile_fsync = true;
+        break;
+      case 'm':
+        output_config->metrics_listen = optarg;
+        break;
+      case 's':
+        output_config->trigger_socket = optarg;
+        break;
+      case 't':
+        output_config->freshness_ttl_seconds = convert_str_to_int(optarg);
+        if (output_config->freshness_ttl_seconds < MIN_WAIT_SECONDS) {
+               fprintf (stderr,
+                        "ERROR: Invalid freshness TTL '%d'. The sensor can't "
+                        "be sampled more often than every %d seconds.\n",
+                        output_config->freshness_ttl_seconds,
+                        MIN_WAIT_SECONDS);
+               exit(22);
+        }
+        break;
       case '?':
         if (optopt == 'g')
           fprintf (stderr,
@@ -278,6 +436,62 @@ void parse_command_line(int argc, char *const *argv,
       default:
         abort ();
       }
+  }
+
+  // refuse the options that would be silently ignored
+  if (output_config->aggregator_listen != NULL) {
+    // (the aggregator doesn't sample, nor write a textfile of its own)
+    for (const char * option = "fgwduobamstcPxiF"; *option != '\0'; option++)
+      if (options_given[(unsigned char)*option]) {
+        fprintf(stderr, "ERROR: Option -%c is not used by the fleet "
+                        "aggregator (-A).\n", *option);
+        exit(39);
+      }
+    if (optind < argc) {
+      fprintf(stderr, "ERROR: The Prometheus labels are not used by the "
+                      "fleet aggregator (-A): its series have the labels of "
+                      "the samplers.\n");
+      exit(39);
+    }
+  }
+  bool on_demand = (output_config->metrics_listen != NULL ||
+                    output_config->trigger_socket != NULL);
+  const char * ignored_option = NULL;
+  if (on_demand && output_config->change_threshold > 0)
+    ignored_option = "-c is not used in the on-demand mode (-m, -s)";
+  else if (on_demand && output_config->republish_seconds > 0)
+    ignored_option = "-P is not used in the on-demand mode (-m, -s)";
+  else if (! on_demand && output_config->freshness_ttl_seconds > 0)
+    ignored_option = "-t is only used in the on-demand mode (-m, -s)";
+  else if (output_config->change_threshold <= 0 &&
+           output_config->republish_seconds > 0)
+    ignored_option = "-P is only used in the adaptive mode (-c)";
+  else if (output_config->udp_target == NULL && options_given['o'])
+    ignored_option = "-o is only used with the UDP output (-u)";
+  else if (output_config->udp_target == NULL && options_given['b'])
+    ignored_option = "-b is only used with the UDP output (-u)";
+  if (ignored_option != NULL) {
+    fprintf(stderr, "ERROR: Option %s.\n", ignored_option);
+    exit(39);
+  }
+
+  // the republish is only checked at the samples, at most '-w' apart: a
+  // shorter '-P' couldn't be honoured
+  if (output_config->republish_seconds > 0 &&
+      output_config->republish_seconds < output_config->wait_seconds) {
+    fprintf(stderr, "ERROR: Invalid republish time '%d'. "
+                    "It can't be shorter than the wait time, %d seconds.\n",
+            output_config->republish_seconds, output_config->wait_seconds);
+    exit(32);
+  }
+
+  // the aggregator keys the series by their label set: samplers pushing
+  // without labels would overwrite each other's
+  if (output_config->fleet_target != NULL && optind >= argc) {
+    fprintf(stderr, "ERROR: Option -a needs the Prometheus labels that tell "
+                    "this sampler apart in the aggregator.\n");
+    exit(40);
+  }
 
   for (int index = optind; index < argc; index++)
     check_and_save_prometheus_label(argv[index], output_config);
@@ -293,15 +507,15 @@ void print_prometheus_labels(FILE *output,
     return;  // no Prometheus labels to print
 
   assert(config->prometheus_labels != NULL);
-  printf("{");
+  fputs("{", output);
   for (int label_idx=0, remaining_idx = config->num_prometheus_labels;
        label_idx < config->num_prometheus_labels;
        label_idx++, remaining_idx--) {
-    printf(config->prometheus_labels[label_idx]);
+    fputs(config->prometheus_labels[label_idx], output);
     if (remaining_idx > 1)
-      printf(", ");   // print a comma after label-value pair, except for last
+      fputs(", ", output);  // print a comma after label-value pair, except last
   }
-  printf("}");
+  fputs("}", output);
 }
 
 unsigned long long get_curr_epoch_microsec(clockid_t according_to_clock) {
@@ -317,6 +531,19 @@ unsigned long long get_curr_epoch_microsec(clockid_t according_to_clock) {
   return epoch_microsec;
 }
 
+const char * temperature_metric(float * dht22_temp,
+                               const struct configuration_settings * config) {
+
+  // deal with the case whether to report the temperature in the original
+  // Celsius degrees, or to convert the Celsius to Farenheit and report the
+  // temperature in Farenheit
+  if (config->temperature_in_farenheit) {
+    *dht22_temp = *dht22_temp * ( 9.0 / 5.0 ) + 32.0;
+    return "dht22_temperature_farenheit";
+  }
+  return "dht22_temperature_celsius";
+}
+
 void dht22_values_to_prometheus(FILE *output,
                                 float dht22_temp, float dht22_humidity,
                                 const struct configuration_settings * config) {
@@ -349,14 +576,9 @@ void dht22_values_to_prometheus(FILE *output,
   print_prometheus_labels(output, config);
   fprintf(output, fprintf_format_str_metric_value_suffix, dht22_humidity);
 
-  // print the temperature metric for Prometheus: deal with the case whether
-  // report it in the original Celsius degrees, or to convert the Celsius to
-  // Farenheit and report the temperature to Prometheus in Farenheit
-  char * temperature_metric_name = "dht22_temperature_celsius";
-  if (config->temperature_in_farenheit) {
-    temperature_metric_name = "dht22_temperature_farenheit";
-    dht22_temp = dht22_temp * ( 9.0 / 5.0 ) + 32.0;
-  }
+  // print the temperature metric for Prometheus, in Celsius or Farenheit
+  const char * temperature_metric_name = temperature_metric(&dht22_temp,
+                                                            config);
   fprintf(output, "# TYPE %1$s gauge\n"
                   "# HELP %1$s Temperature in the RHT03/DHT22 sensor\n"
                   "%1$s",
@@ -386,92 +608,817 @@ FILE * create_temporary_filename(char * temp_fname,
   }
 }
 
-void sample_dht22_sensor_to_prometheus(
-                   const struct configuration_settings * config
-) {
+void push_sample_to_fleet(float dht22_temp, float dht22_humidity,
+                          const struct configuration_settings * config) {
+
+  struct fleet_sample sample = {
+                          .flags = config->temperature_in_farenheit ?
+                                     FLEET_FRAME_FLAG_FARENHEIT : 0,
+                          .humidity_tenths = lroundf(dht22_humidity * 10),
+                          .temperature_tenths = lroundf(dht22_temp * 10),
+                          .labels = config->fleet_labels,
+                          .labels_len = config->fleet_labels_len
+                        };
+  uint8_t frame[FLEET_FRAME_MAX_SIZE];
+  size_t frame_len = fleet_frame_encode(frame, sizeof frame, &sample);
+
+  if (send(config->fleet_push_fd, frame, frame_len, MSG_DONTWAIT) == -1) {
+    int old_errno = errno;
+    char err_msg[256];
+    strerror_r(old_errno, err_msg, sizeof err_msg);
+    fprintf(stderr, "WARNING: Could not push the sample to the fleet "
+                    "aggregator: %d: %s\n", old_errno, err_msg);
+  }
+}
+
+int read_dht22_sensor(const struct configuration_settings * config,
+                      float * temperature, float * relative_humidity) {
 
   const int sensor_type = DHT22;
 
-  float temperature = 0, relative_humidity = 0;
+  // wait for the other samplers' capture windows (at the normal priority:
+  // pi_2_dht_read() raises it)
+  bool arbitrated = (config->arbiter != NULL &&
+                     capture_arbiter_acquire(config->arbiter) == 0);
 
   /* Try to read humidity and temperature from the DHT22 sensor attached
    * to the Raspberry Pi 2/3 at GPIO dht22_gpio_idx */
 
   int err_code = pi_2_dht_read(sensor_type,
       	                 config->dht22_gpio_idx,
-                         &relative_humidity, &temperature);
+                         relative_humidity, temperature);
+
+  if (arbitrated)
+    capture_arbiter_release(config->arbiter);
 
   if (err_code != DHT_SUCCESS) {
     fprintf(stderr, "ERROR: couldn't read DHT22 sensor data. Error: %d\n",
             err_code);
-  } else {
-    char text_collector_temp_fname[PATH_MAX+1];
-    FILE * text_collector_file = create_temporary_filename(
+  }
+  return err_code;
+}
+
+void print_arbiter_metrics(FILE * output,
+                           const struct configuration_settings * config) {
+
+  if (config->arbiter == NULL)
+    return;
+  fprintf(output, "# TYPE dht22_arbiter_wait_seconds_total counter\n"
+                  "# HELP dht22_arbiter_wait_seconds_total Time waited for "
+                  "other samplers to end their reads of their sensors\n"
+                  "dht22_arbiter_wait_seconds_total");
+  print_prometheus_labels(output, config);
+  fprintf(output, " %.6f\n", capture_arbiter_wait_seconds(config->arbiter));
+  fprintf(output, "# TYPE dht22_arbiter_owner_deaths_total counter\n"
+                  "# HELP dht22_arbiter_owner_deaths_total Times the lock "
+                  "was taken over from a sampler killed in the middle of "
+                  "its read\n"
+                  "dht22_arbiter_owner_deaths_total");
+  print_prometheus_labels(output, config);
+  fprintf(output, " %llu\n", capture_arbiter_owner_deaths(config->arbiter));
+}
+
+void print_textfile_write_metrics(FILE * output,
+                                  const struct configuration_settings * config) {
+
+  if (! config->textfile_uring)
+    return;
+  // (the synchronous writes too: those that didn't find a free buffer in
+  // the ring, or all of them if io_uring is not available)
+  unsigned long long writes = config->textfile_timings->writes;
+  double seconds_total = config->textfile_timings->seconds_total;
+  if (config->textfile_ring != NULL) {
+    writes += textfile_ring_completed(config->textfile_ring);
+    seconds_total += textfile_ring_latency_seconds(config->textfile_ring);
+  }
+  fprintf(output, "# TYPE dht22_textfile_write_seconds summary\n"
+                  "# HELP dht22_textfile_write_seconds Time from the start "
+                  "of the write of this file to its rename (through "
+                  "io_uring: from the submission to the completion)\n"
+                  "dht22_textfile_write_seconds_sum");
+  print_prometheus_labels(output, config);
+  fprintf(output, " %.6f\n"
+                  "dht22_textfile_write_seconds_count", seconds_total);
+  print_prometheus_labels(output, config);
+  fprintf(output, " %llu\n", writes);
+
+  if (config->textfile_ring != NULL) {
+    fprintf(output, "# TYPE dht22_textfile_io_uring_enters_total counter\n"
+                    "# HELP dht22_textfile_io_uring_enters_total System "
+                    "calls made to write this file through io_uring\n"
+                    "dht22_textfile_io_uring_enters_total");
+    print_prometheus_labels(output, config);
+    fprintf(output, " %llu\n", textfile_ring_enters(config->textfile_ring));
+  }
+}
+
+void render_textfile(FILE * output,
+                     float temperature, float relative_humidity,
+                     int sampling_period_seconds,
+                     const struct configuration_settings * config) {
+
+  dht22_values_to_prometheus(output, temperature, relative_humidity, config);
+
+  if (sampling_period_seconds > 0) {    // only in the adaptive mode
+    fprintf(output,
+            "# TYPE dht22_sampling_period_seconds gauge\n"
+            "# HELP dht22_sampling_period_seconds Current period of the "
+            "adaptive sampling of the RHT03/DHT22 sensor\n"
+            "dht22_sampling_period_seconds");
+    print_prometheus_labels(output, config);
+    fprintf(output, " %d\n", sampling_period_seconds);
+  }
+  print_arbiter_metrics(output, config);
+  print_textfile_write_metrics(output, config);
+}
+
+void write_textfile(float temperature, float relative_humidity,
+                    int sampling_period_seconds,
+                    const struct configuration_settings * config) {
+
+  unsigned long long start_usec = get_curr_epoch_microsec(CLOCK_MONOTONIC);
+  char text_collector_temp_fname[PATH_MAX+1];
+  FILE * text_collector_file = create_temporary_filename(
 		                       text_collector_temp_fname,
-                                       config->text_collector_fname
+                                     config->text_collector_fname
 				 );
-    int could_create_file = ( text_collector_file != NULL );
-    if (! could_create_file) text_collector_file = stdout;
-
-    dht22_values_to_prometheus(text_collector_file,
-		    temperature, relative_humidity,
-		    config);
-
-    if (could_create_file) {    // if it is not stdout, then:
-      fclose(text_collector_file);
-      // Prometheus' Text-Collector requires to atomically create and fill
-      // the text file with the metric values, and this is why the use of the
-      // temporary filename, and its final rename() here
-      fprintf(stderr, "DEBUG: renaming '%s' to '%s'...\n",
+  int could_create_file = ( text_collector_file != NULL );
+  if (! could_create_file) text_collector_file = stdout;
+
+  render_textfile(text_collector_file,
+                  temperature, relative_humidity, sampling_period_seconds,
+                  config);
+
+  if (could_create_file) {    // if it is not stdout, then:
+    if (config->textfile_fsync &&
+        (fflush(text_collector_file) == EOF ||
+         fsync(fileno(text_collector_file)) == -1)) {
+      int old_errno = errno;
+      char err_msg[256];
+      strerror_r(old_errno, err_msg, sizeof err_msg);
+      fprintf(stderr, "WARNING: Could not fsync '%s': %d: %s\n",
+              text_collector_temp_fname, old_errno, err_msg);
+    }
+    fclose(text_collector_file);
+    // Prometheus' Text-Collector requires to atomically create and fill
+    // the text file with the metric values, and this is why the use of the
+    // temporary filename, and its final rename() here
+    fprintf(stderr, "DEBUG: renaming '%s' to '%s'...\n",
 	      text_collector_temp_fname, config->text_collector_fname);
-      int result = rename(text_collector_temp_fname,
+    int result = rename(text_collector_temp_fname,
 	                  config->text_collector_fname);
-      if (result == -1) {
-        int old_errno = errno;
-        char err_msg[256];
-        strerror_r(old_errno, err_msg, sizeof err_msg);
-        fprintf(stderr, "WARNING: Could not rename files: %d: %s\n",
+    if (result == -1) {
+      int old_errno = errno;
+      char err_msg[256];
+      strerror_r(old_errno, err_msg, sizeof err_msg);
+      fprintf(stderr, "WARNING: Could not rename files: %d: %s\n",
 		old_errno, err_msg);
-      }
+    }
+    if (config->textfile_timings != NULL) {
+      config->textfile_timings->writes++;
+      config->textfile_timings->seconds_total +=
+            (get_curr_epoch_microsec(CLOCK_MONOTONIC) - start_usec) / 1e6;
     }
   }
 }
 
-void do_main_loop(const struct configuration_settings * config) {
+// Render the textfile into a free buffer of the io_uring ring, and queue its
+// write. Returns false if it has to be written synchronously instead.
+bool queue_textfile_write(float temperature, float relative_humidity,
+                          int sampling_period_seconds,
+                          const struct configuration_settings * config) {
+
+  char * buffer = textfile_ring_buffer(config->textfile_ring);
+  if (buffer == NULL)
+    return false;     // all of them in flight
+  FILE * output = fmemopen(buffer, TEXTFILE_RING_BUFFER_SIZE, "w");
+  if (output == NULL)
+    return false;
+  render_textfile(output, temperature, relative_humidity,
+                  sampling_period_seconds, config);
+  long len = ftell(output);
+  fclose(output);
+
+  // (a full buffer, but for fmemopen()'s final '\0', is a truncated file)
+  return len > 0 && len < TEXTFILE_RING_BUFFER_SIZE - 1 &&
+         textfile_ring_queue(config->textfile_ring,
+                             config->text_collector_fname, len) == 0;
+}
 
-  int timer_fd;    // The timer file descriptor (for timerfd_create())
-  struct itimerspec its;
+void publish_dht22_sample(float temperature, float relative_humidity,
+                          int sampling_period_seconds,
+                          const struct configuration_settings * config) {
+
+  // through io_uring, the file is written after this returns: its
+  // completion is reaped from the main loop
+  if (config->textfile_ring == NULL ||
+      ! queue_textfile_write(temperature, relative_humidity,
+                             sampling_period_seconds, config) ||
+      textfile_ring_submit(config->textfile_ring) == -1) {
+    // (no older write still in flight may be renamed over this one)
+    if (config->textfile_ring != NULL)
+      textfile_ring_wait(config->textfile_ring);
+    write_textfile(temperature, relative_humidity, sampling_period_seconds,
+                   config);
+  }
 
-  /* create the file-descriptor's based timer */
-  timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
-  if (timer_fd == -1) {
-    report_errno_and_exit(14, "ERROR: while calling timerfd_create()");
+  if (config->fleet_push_fd != -1) {
+    push_sample_to_fleet(temperature, relative_humidity, config);
   }
 
-  its.it_value.tv_sec = 1;
+  if (config->udp_publisher != NULL) {
+    const char * temperature_metric_name = temperature_metric(&temperature,
+                                                              config);
+    udp_publisher_add_sample(config->udp_publisher,
+                             temperature_metric_name,
+                             temperature, relative_humidity,
+                             get_curr_epoch_microsec(CLOCK_REALTIME) * 1000);
+  }
+}
+
+void sample_dht22_sensor_to_prometheus(
+                   const struct configuration_settings * config
+) {
+
+  float temperature = 0, relative_humidity = 0;
+
+  if (read_dht22_sensor(config, &temperature, &relative_humidity) ==
+        DHT_SUCCESS) {
+    publish_dht22_sample(temperature, relative_humidity, 0, config);
+  }
+}
+
+bool changed_beyond(float threshold, float temperature_a, float humidity_a,
+                    float temperature_b, float humidity_b) {
+  return fabsf(temperature_a - temperature_b) > threshold ||
+         fabsf(humidity_a - humidity_b) > threshold;
+}
+
+// Take a sample in the adaptive mode, and return the period until the next.
+int sample_adaptively(struct adaptive_cadence * cadence,
+                      const struct configuration_settings * config) {
+
+  float temperature = 0, relative_humidity = 0;
+
+  if (read_dht22_sensor(config, &temperature, &relative_humidity) !=
+        DHT_SUCCESS) {
+    return cadence->period_seconds;
+  }
+
+  // On a change, go straight to the sensor's fastest rate, so as not to miss
+  // the rest of a transient; while stable, back off exponentially to the
+  // '-w' period.
+  if (cadence->have_sample &&
+      changed_beyond(config->change_threshold, temperature, relative_humidity,
+                     cadence->temperature, cadence->relative_humidity)) {
+    cadence->period_seconds = MIN_WAIT_SECONDS;
+  } else {
+    cadence->period_seconds *= 2;
+    if (cadence->period_seconds > config->wait_seconds)
+      cadence->period_seconds = config->wait_seconds;
+  }
+  cadence->have_sample = true;
+  cadence->temperature = temperature;
+  cadence->relative_humidity = relative_humidity;
+
+  // Don't rewrite a sample that didn't change since the last one written,
+  // unless that one is getting old: consumers (and Prometheus' staleness)
+  // need to see a fresh sample at least every '-P republish_seconds'.
+  // (half a second early is still on time: the reads take variable time)
+  // A new period is always written, since it is reported with the sample.
+  unsigned long long now = get_curr_epoch_microsec(CLOCK_MONOTONIC);
+  if (! cadence->have_published ||
+      cadence->period_seconds != cadence->published_period_seconds ||
+      now - cadence->published_at_usec + 500000 >=
+        (unsigned long long)config->republish_seconds * 1000000 ||
+      changed_beyond(config->change_threshold, temperature, relative_humidity,
+                     cadence->published_temperature,
+                     cadence->published_humidity)) {
+    publish_dht22_sample(temperature, relative_humidity,
+                         cadence->period_seconds, config);
+    cadence->have_published = true;
+    cadence->published_temperature = temperature;
+    cadence->published_humidity = relative_humidity;
+    cadence->published_period_seconds = cadence->period_seconds;
+    cadence->published_at_usec = now;
+  }
+  return cadence->period_seconds;
+}
+
+// The state of the on-demand mode: the last sample read, and counters
+struct on_demand_state {
+  bool have_sample;
+  float temperature;
+  float relative_humidity;
+  unsigned long long sampled_at_usec;     // CLOCK_MONOTONIC
+  unsigned long long attempted_at_usec;
+  unsigned long long reads;
+  unsigned long long failed_reads;
+  unsigned long long requests;
+  unsigned long long served_from_cache;
+};
+
+struct on_demand_sampler {
+  struct event_source trigger;      // the Unix socket, if any
+  const struct configuration_settings * config;
+  struct metrics_http_server * metrics;
+  struct on_demand_state state;     // (what is handed over)
+};
+
+// The state handed over to the next process of the sampler. The file
+// descriptors follow it: in the periodic mode, the timerfd; in the on-demand
+// mode, the /metrics listener and then the trigger socket, if configured.
+struct handover_state {
+  uint32_t version;
+  bool on_demand_mode;
+  int arbiter_slot;                       // -1 without an arbiter
+  struct adaptive_cadence cadence;
+  struct on_demand_state on_demand;
+};
+
+struct sampler_handover {
+  struct event_source signals;    // the signalfd: HANDOVER_SIGNAL, SIGTERM...
+  const struct configuration_settings * config;
+  char exe[PATH_MAX+1];                   // this binary, as of the start-up
+  char ** argv;
+  int inherited_socket;                   // -1 unless taking over
+  struct handover_state inherited;
+  int inherited_fds[HANDOVER_MAX_FDS];
+  int num_inherited_fds;
+  int next_inherited_fd;
+  struct on_demand_sampler * on_demand;
+};
+
+int arbiter_slot(const struct configuration_settings * config) {
+  return config->arbiter != NULL ? capture_arbiter_slot(config->arbiter) : -1;
+}
+
+int num_handover_fds(const struct configuration_settings * config) {
+  if (config->metrics_listen == NULL && config->trigger_socket == NULL)
+    return 1;     // the periodic mode's timerfd
+  return (config->metrics_listen != NULL) + (config->trigger_socket != NULL);
+}
+
+void prepare_handover(struct sampler_handover * handover, char ** argv,
+                      const struct configuration_settings * config) {
+
+  handover->config = config;
+  handover->argv = argv;
+  // (the path of the binary still names the new one after an upgrade)
+  ssize_t exe_len = readlink("/proc/self/exe", handover->exe,
+                             sizeof handover->exe - 1);
+  handover->exe[exe_len == -1 ? 0 : exe_len] = '\0';
+
+  // The signal, blocked since the start of main(), only arrives through the
+  // signalfd, and so do those that end the sampler, to flush its outputs
+  // first. (The blocked mask is kept across the exec too: in the successor,
+  // an early signal waits for it.)
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, HANDOVER_SIGNAL);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGINT);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+  handover->signals.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (handover->signals.fd == -1) {
+    report_errno_and_exit(33, "ERROR: while calling signalfd()");
+  }
+
+  handover->inherited_socket = handover_inherited_socket();
+  if (handover->inherited_socket == -1)
+    return;     // a normal start
+
+  // Any error until the handover is confirmed leaves the previous process
+  // sampling, so just exit
+  handover->num_inherited_fds = handover_receive(handover->inherited_socket,
+                                                 &handover->inherited,
+                                                 sizeof handover->inherited,
+                                                 handover->inherited_fds,
+                                                 HANDOVER_MAX_FDS);
+  if (handover->num_inherited_fds == -1) {
+    exit(34);
+  }
+  bool on_demand_mode = (config->metrics_listen != NULL ||
+                         config->trigger_socket != NULL);
+  if (handover->inherited.version != HANDOVER_STATE_VERSION ||
+      handover->inherited.on_demand_mode != on_demand_mode ||
+      handover->num_inherited_fds != num_handover_fds(config)) {
+    fprintf(stderr, "ERROR: The state handed over by the previous process "
+                    "doesn't match the command-line of this one.\n");
+    exit(35);
+  }
+}
+
+int take_inherited_fd(struct sampler_handover * handover) {
+  assert(handover->next_inherited_fd < handover->num_inherited_fds);
+  return handover->inherited_fds[handover->next_inherited_fd++];
+}
+
+void finish_taking_over(struct sampler_handover * handover) {
+
+  if (handover->inherited_socket == -1)
+    return;
+  if (handover_ack(handover->inherited_socket) == -1) {
+    report_errno_and_exit(36, "ERROR: while confirming the handover");
+  }
+  handover->inherited_socket = -1;
+  fprintf(stderr, "INFO: Took over from the previous process of the "
+                  "sampler.\n");
+}
+
+// Send what the outputs still hold, before this process exits: the samples
+// batched for UDP, and the textfile in flight through io_uring
+void flush_outputs(const struct configuration_settings * config) {
+  if (config->udp_publisher != NULL)
+    udp_publisher_flush(config->udp_publisher);
+  if (config->textfile_ring != NULL)
+    textfile_ring_wait(config->textfile_ring);
+}
+
+// Read the signals pending in the signalfd. Returns true if any of them asks
+// this process to end (and otherwise they are all HANDOVER_SIGNAL: repeated
+// ones mean a single handover).
+bool termination_requested(struct sampler_handover * handover) {
+  struct signalfd_siginfo siginfo;
+  bool terminate = false;
+  while (read(handover->signals.fd, &siginfo, sizeof siginfo) ==
+           sizeof siginfo)
+    if (siginfo.ssi_signo != HANDOVER_SIGNAL)
+      terminate = true;
+  return terminate;
+}
+
+// Returns true if a new process took over, and so this one has to exit.
+bool hand_over_to_successor(struct sampler_handover * handover,
+                            const struct handover_state * state,
+                            const int * fds, int num_fds) {
+
+  if (handover->exe[0] == '\0') {
+    fprintf(stderr, "WARNING: The path of this binary is unknown: can't hand "
+                    "over to a new process.\n");
+    return false;
+  }
+  flush_outputs(handover->config);
+
+  fprintf(stderr, "INFO: Handing over to a new process of '%s'...\n",
+          handover->exe);
+  pid_t successor_pid;
+  int sock = handover_spawn_successor(handover->exe, handover->argv,
+                                      &successor_pid);
+  if (sock == -1)
+    return false;
+  bool taken_over = (handover_send(sock, state, sizeof *state,
+                                   fds, num_fds) == 0 &&
+                     handover_wait_ack(sock, HANDOVER_ACK_TIMEOUT_MS) == 0);
+  close(sock);
+  if (! taken_over) {
+    fprintf(stderr, "WARNING: The new process didn't take over: this one "
+                    "goes on.\n");
+    kill(successor_pid, SIGKILL);
+    waitpid(successor_pid, NULL, 0);
+  }
+  return taken_over;
+}
+
+// Arm the timer for a sample every "period_seconds", the first one in
+// "first_seconds". With an arbiter, the samples are aligned instead to the
+// offset of this sampler's slot into each period of CLOCK_MONOTONIC (the
+// clock of the other samplers too: so their samples are spread), from the
+// first such time at least a second away.
+void arm_sampling_timer(int timer_fd, int first_seconds, int period_seconds,
+                        const struct configuration_settings * config) {
+
+  struct itimerspec its;
+  int flags = 0;
+
+  its.it_value.tv_sec = first_seconds;
   its.it_value.tv_nsec = 0;
-  its.it_interval.tv_sec = config->wait_seconds;
+  its.it_interval.tv_sec = period_seconds;
   its.it_interval.tv_nsec = 0;
 
-  if (timerfd_settime(timer_fd, 0, &its, NULL) == -1) {
+  if (config->arbiter != NULL) {
+    unsigned long long period_ms = period_seconds * 1000ULL;
+    unsigned long long offset_ms = capture_arbiter_slot(config->arbiter) *
+                                     CAPTURE_ARBITER_SLOT_MS % period_ms;
+    unsigned long long first_ms =
+          get_curr_epoch_microsec(CLOCK_MONOTONIC) / 1000 + 1000;
+    unsigned long long next_ms =
+          (first_ms - offset_ms + period_ms - 1) / period_ms * period_ms +
+          offset_ms;
+    its.it_value.tv_sec = next_ms / 1000;
+    its.it_value.tv_nsec = (next_ms % 1000) * 1000000;
+    flags = TFD_TIMER_ABSTIME;
+  }
+
+  if (timerfd_settime(timer_fd, flags, &its, NULL) == -1) {
     report_errno_and_exit(15, "ERROR: while calling timerfd_settime()");
   }
+}
+
+void do_main_loop(const struct configuration_settings * config,
+                  struct sampler_handover * handover) {
+
+  int timer_fd;    // The timer file descriptor (for timerfd_create())
+  struct adaptive_cadence cadence = { .period_seconds = config->wait_seconds };
+
+  if (handover->inherited_socket != -1) {
+    // go on with the timer of the previous process, and so with its phase:
+    // the ticks during the handover are read below
+    timer_fd = take_inherited_fd(handover);
+    cadence = handover->inherited.cadence;
+  } else {
+    /* create the file-descriptor's based timer */
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timer_fd == -1) {
+      report_errno_and_exit(14, "ERROR: while calling timerfd_create()");
+    }
+
+    arm_sampling_timer(timer_fd, 1, config->wait_seconds, config);
+  }
+  finish_taking_over(handover);
 
   uint64_t missed = 1;
+  // (poll() ignores the negative fd without an io_uring ring)
+  struct pollfd pollfds[3] = { { .fd = timer_fd, .events = POLLIN },
+                               { .fd = handover->signals.fd,
+                                 .events = POLLIN },
+                               { .fd = config->textfile_ring != NULL ?
+                                         textfile_ring_fd(
+                                               config->textfile_ring) : -1,
+                                 .events = POLLIN } };
+
+  for (;;) {
+    if (poll(pollfds, 3, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      report_errno_and_exit(37, "ERROR: while calling poll()");
+    }
 
-  while (read(timer_fd, &missed, sizeof(missed)) != -1 && missed > 0) {
-    if (missed > 1) {
-      fprintf(stderr, "WARNING: the RHT03/DHT22 sampling code was slow enough "
-		      "as to miss %llu samples when sampling every %d seconds "
-		      "(use the '-w' command-line option to change sampling "
-		      "period)\n", missed, config->wait_seconds);
+    if (pollfds[2].revents & POLLIN)
+      textfile_ring_reap(config->textfile_ring);
+
+    // a sample that is due goes before a handover
+    if (pollfds[0].revents & POLLIN) {
+      if (read(timer_fd, &missed, sizeof(missed)) == -1 || missed == 0)
+        break;
+      if (missed > 1) {
+        fprintf(stderr, "WARNING: the RHT03/DHT22 sampling code was slow "
+                        "enough as to miss %llu samples when sampling every "
+                        "%d seconds (use the '-w' command-line option to "
+                        "change sampling period)\n",
+                        missed, cadence.period_seconds);
+      }
+      if (config->change_threshold <= 0) {
+        sample_dht22_sensor_to_prometheus(config);
+      } else {
+        int old_period = cadence.period_seconds;
+        if (sample_adaptively(&cadence, config) != old_period) {
+          // re-arm the timer with the new period, from now on
+          arm_sampling_timer(timer_fd, cadence.period_seconds,
+                             cadence.period_seconds, config);
+        }
+      }
+    }
+
+    if (pollfds[1].revents & POLLIN) {
+      if (termination_requested(handover))
+        break;
+      struct handover_state state = { .version = HANDOVER_STATE_VERSION,
+                                      .on_demand_mode = false,
+                                      .arbiter_slot = arbiter_slot(config),
+                                      .cadence = cadence };
+      if (hand_over_to_successor(handover, &state, &timer_fd, 1))
+        exit(0);
     }
-    sample_dht22_sensor_to_prometheus(config);
   }
 
+  flush_outputs(config);
   close(timer_fd);
 }
 
+void ensure_fresh_sample(struct on_demand_sampler * sampler) {
+
+  const struct configuration_settings * config = sampler->config;
+  unsigned long long now = get_curr_epoch_microsec(CLOCK_MONOTONIC);
+  sampler->state.requests++;
+
+  if (sampler->state.have_sample &&
+      now - sampler->state.sampled_at_usec <
+        (unsigned long long)config->freshness_ttl_seconds * 1000000) {
+    sampler->state.served_from_cache++;
+    return;
+  }
+  // the sensor can't be sampled more often than this, even after a failure
+  if (sampler->state.reads > 0 &&
+      now - sampler->state.attempted_at_usec <
+        (unsigned long long)MIN_WAIT_SECONDS * 1000000) {
+    sampler->state.served_from_cache++;
+    return;
+  }
+
+  // The read takes more than half a second, and the requests that arrive in
+  // the meantime wait in the epoll loop: they are all served afterwards from
+  // this same sample, so concurrent scrapes coalesce onto this one read.
+  float temperature = 0, relative_humidity = 0;
+  sampler->state.attempted_at_usec = now;
+  sampler->state.reads++;
+  if (read_dht22_sensor(config, &temperature, &relative_humidity) !=
+        DHT_SUCCESS) {
+    sampler->state.failed_reads++;
+    return;     // serve the last good sample, if any
+  }
+  sampler->state.have_sample = true;
+  sampler->state.temperature = temperature;
+  sampler->state.relative_humidity = relative_humidity;
+  sampler->state.sampled_at_usec = get_curr_epoch_microsec(CLOCK_MONOTONIC);
+  publish_dht22_sample(temperature, relative_humidity, 0, config);
+}
+
+void render_on_demand_metrics(FILE * output, void * render_arg) {
+
+  struct on_demand_sampler * sampler = render_arg;
+  const struct configuration_settings * config = sampler->config;
+
+  ensure_fresh_sample(sampler);
+
+  if (sampler->state.have_sample) {
+    dht22_values_to_prometheus(output, sampler->state.temperature,
+                               sampler->state.relative_humidity, config);
+    double age_seconds = (get_curr_epoch_microsec(CLOCK_MONOTONIC) -
+                          sampler->state.sampled_at_usec) / 1e6;
+    fprintf(output, "# TYPE dht22_sample_age_seconds gauge\n"
+                    "# HELP dht22_sample_age_seconds Age of the RHT03/DHT22 "
+                    "sample served\n"
+                    "dht22_sample_age_seconds");
+    print_prometheus_labels(output, config);
+    fprintf(output, " %.3f\n", age_seconds);
+  }
+
+  const char * counter_names[] = { "dht22_sensor_reads_total",
+                                   "dht22_sensor_read_failures_total",
+                                   "dht22_requests_served_from_cache_total" };
+  const char * counter_helps[] = { "Reads of the RHT03/DHT22 sensor",
+                                   "Failed reads of the RHT03/DHT22 sensor",
+                                   "Requests served without a new read" };
+  unsigned long long counters[] = { sampler->state.reads,
+                                    sampler->state.failed_reads,
+                                    sampler->state.served_from_cache };
+  for (int i = 0; i < 3; i++) {
+    fprintf(output, "# TYPE %1$s counter\n"
+                    "# HELP %1$s %2$s\n"
+                    "%1$s", counter_names[i], counter_helps[i]);
+    print_prometheus_labels(output, config);
+    fprintf(output, " %llu\n", counters[i]);
+  }
+  print_arbiter_metrics(output, config);
+}
+
+void on_trigger_event(struct event_source * source, uint32_t events) {
+
+  struct on_demand_sampler * sampler = (struct on_demand_sampler *)source;
+
+  for (;;) {
+    // (on Linux, the accepted socket doesn't inherit the O_NONBLOCK flag)
+    int conn_fd = accept(source->fd, NULL, NULL);
+    if (conn_fd == -1)
+      return;     // EAGAIN: no more pending triggers
+    // answer with the metrics, but never let a stuck client stall the loop
+    struct timeval send_timeout = { .tv_sec = 1, .tv_usec = 0 };
+    setsockopt(conn_fd, SOL_SOCKET, SO_SNDTIMEO,
+               &send_timeout, sizeof send_timeout);
+    FILE * conn = fdopen(conn_fd, "w");
+    if (conn == NULL) {
+      close(conn_fd);
+      continue;
+    }
+    render_on_demand_metrics(conn, sampler);
+    fclose(conn);
+  }
+}
+
+void on_signals(struct event_source * source, uint32_t events) {
+
+  struct sampler_handover * handover = (struct sampler_handover *)source;
+  struct on_demand_sampler * sampler = handover->on_demand;
+  if (termination_requested(handover)) {
+    flush_outputs(sampler->config);
+    exit(0);
+  }
+
+  struct handover_state state = { .version = HANDOVER_STATE_VERSION,
+                                  .on_demand_mode = true,
+                                  .arbiter_slot =
+                                        arbiter_slot(sampler->config),
+                                  .on_demand = sampler->state };
+  int fds[2];
+  int num_fds = 0;
+
+  if (sampler->metrics != NULL)
+    fds[num_fds++] = metrics_http_listen_fd(sampler->metrics);
+  if (sampler->config->trigger_socket != NULL)
+    fds[num_fds++] = sampler->trigger.fd;
+
+  // (the scrapes already accepted by this process are cut short)
+  if (hand_over_to_successor(handover, &state, fds, num_fds))
+    exit(0);
+}
+
+int open_trigger_socket(const char * socket_path) {
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof addr.sun_path) {
+    fprintf(stderr, "ERROR: Unix socket path '%s' is too long: its max "
+                    "length allowable is %zu.\n",
+                    socket_path, sizeof addr.sun_path - 1);
+    exit(24);
+  }
+  strcpy(addr.sun_path, socket_path);
+
+  int sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (sock_fd == -1) {
+    report_errno_and_exit(25, "ERROR: while calling socket()");
+  }
+  unlink(socket_path);    // a leftover of a previous run
+  if (bind(sock_fd, (struct sockaddr *)&addr, sizeof addr) == -1 ||
+      listen(sock_fd, SOMAXCONN) == -1) {
+    report_errno_and_exit(26, "ERROR: while listening on the Unix socket");
+  }
+  return sock_fd;
+}
+
+// The completions of the writes of the textfile through io_uring, in the
+// epoll loop of the on-demand mode
+struct textfile_completions {
+  struct event_source ring;
+  struct textfile_ring * textfile_ring;
+};
+
+void on_textfile_completions(struct event_source * source, uint32_t events) {
+  struct textfile_completions * completions =
+        (struct textfile_completions *)source;
+  textfile_ring_reap(completions->textfile_ring);
+}
+
+void run_on_demand_sampler(const struct configuration_settings * config,
+                           struct sampler_handover * handover) {
+
+  static struct on_demand_sampler sampler;
+  bool taking_over = (handover->inherited_socket != -1);
+  if (taking_over) {
+    // the last sample and the counters (the rest is set anew below)
+    sampler.state = handover->inherited.on_demand;
+  }
+  sampler.config = config;
+  sampler.metrics = NULL;
+
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1) {
+    report_errno_and_exit(27, "ERROR: while calling epoll_create1()");
+  }
+
+  if (config->metrics_listen != NULL) {
+    sampler.metrics = taking_over ?
+        metrics_http_create_on_socket(take_inherited_fd(handover), epoll_fd,
+                                      render_on_demand_metrics, &sampler) :
+        metrics_http_create(config->metrics_listen, epoll_fd,
+                            render_on_demand_metrics, &sampler);
+    if (sampler.metrics == NULL) {
+      exit(29);
+    }
+  }
+
+  if (config->trigger_socket != NULL) {
+    sampler.trigger.fd = taking_over ?
+        take_inherited_fd(handover) :
+        open_trigger_socket(config->trigger_socket);
+    sampler.trigger.on_event = on_trigger_event;
+    if (event_source_add(epoll_fd, &sampler.trigger, EPOLLIN) == -1) {
+      report_errno_and_exit(28, "ERROR: while calling epoll_ctl()");
+    }
+  }
+
+  static struct textfile_completions completions;
+  if (config->textfile_ring != NULL) {
+    completions.textfile_ring = config->textfile_ring;
+    completions.ring.fd = textfile_ring_fd(config->textfile_ring);
+    completions.ring.on_event = on_textfile_completions;
+    if (event_source_add(epoll_fd, &completions.ring, EPOLLIN) == -1) {
+      report_errno_and_exit(28, "ERROR: while calling epoll_ctl()");
+    }
+  }
+
+  handover->on_demand = &sampler;
+  handover->signals.on_event = on_signals;
+  if (event_source_add(epoll_fd, &handover->signals, EPOLLIN) == -1) {
+    report_errno_and_exit(28, "ERROR: while calling epoll_ctl()");
+  }
+  finish_taking_over(handover);
+
+  event_loop_run(epoll_fd);
+}
+
 int main(int argc, char *argv[]) {
 
   struct configuration_settings actual_config = {
@@ -483,10 +1430,125 @@ int main(int argc, char *argv[]) {
 						   "/"
 						   PROMETHEUS_TEXT_COLL_FILE,
                                         .prometheus_labels = NULL,
-                                        .num_prometheus_labels = 0
+                                        .num_prometheus_labels = 0,
+                                        .udp_target = NULL,
+                                        .udp_format = UDP_FORMAT_INFLUX,
+                                        .udp_batch_samples =
+                                                  DEFAULT_UDP_BATCH_SAMPLES,
+                                        .udp_publisher = NULL,
+                                        .fleet_target = NULL,
+                                        .fleet_push_fd = -1,
+                                        .fleet_labels = NULL,
+                                        .fleet_labels_len = 0,
+                                        .aggregator_listen = NULL,
+                                        .metrics_listen = NULL,
+                                        .trigger_socket = NULL,
+                                        .freshness_ttl_seconds = 0,
+                                        .change_threshold = 0,
+                                        .republish_seconds = 0,
+                                        .arbiter_name = NULL,
+                                        .arbiter = NULL,
+                                        .textfile_fsync = false,
+                                        .textfile_uring = false,
+                                        .textfile_ring = NULL,
+                                        .textfile_timings = NULL
                                       };
 
+  // The handover signal must never kill the process, e.g. before the
+  // handover is set up: block it from the start (prepare_handover() reads
+  // it then from a signalfd)
+  sigset_t handover_mask;
+  sigemptyset(&handover_mask);
+  sigaddset(&handover_mask, HANDOVER_SIGNAL);
+  sigprocmask(SIG_BLOCK, &handover_mask, NULL);
+
   parse_command_line(argc, argv, &actual_config);
 
-  do_main_loop(&actual_config);
+#ifdef PI_2_MMIO_SIMULATED
+  // wire the simulated sensor to the GPIO index of '-g'
+  struct dht_sim_settings sim_settings;
+  dht_sim_default_settings(&sim_settings);
+  sim_settings.gpio_idx = actual_config.dht22_gpio_idx;
+  dht_sim_configure(&sim_settings);
+#endif
+
+  if (actual_config.republish_seconds == 0)
+    actual_config.republish_seconds = actual_config.wait_seconds;
+
+  if (actual_config.aggregator_listen != NULL) {
+    // the aggregator doesn't sample any sensor of its own, and it doesn't
+    // hand over: a 'pkill -USR2' meant for the samplers leaves it alone
+    signal(HANDOVER_SIGNAL, SIG_IGN);
+    run_fleet_aggregator(actual_config.aggregator_listen);
+    exit(19);
+  }
+
+  static struct sampler_handover handover;
+  prepare_handover(&handover, argv, &actual_config);
+
+  if (actual_config.arbiter_name != NULL) {
+    // (a new process after a handover keeps the slot of the previous one)
+    actual_config.arbiter =
+          capture_arbiter_open(actual_config.arbiter_name,
+                               handover.inherited_socket != -1 ?
+                                 handover.inherited.arbiter_slot : -1);
+    if (actual_config.arbiter == NULL) {
+      exit(38);
+    }
+  }
+
+  static struct textfile_timings textfile_timings;
+  actual_config.textfile_timings = &textfile_timings;
+  if (actual_config.textfile_uring) {
+    actual_config.textfile_ring =
+          textfile_ring_create(actual_config.textfile_fsync);
+    if (actual_config.textfile_ring == NULL) {
+      fprintf(stderr, "WARNING: Writing the textfile synchronously "
+                      "instead.\n");
+    }
+  }
+
+  if (actual_config.fleet_target != NULL) {
+    static char fleet_labels[FLEET_FRAME_MAX_LABELS_LEN + 1];
+    actual_config.fleet_labels = fleet_labels;
+    actual_config.fleet_labels_len =
+          fleet_join_labels(fleet_labels, sizeof fleet_labels,
+                            actual_config.prometheus_labels,
+                            actual_config.num_prometheus_labels);
+    if (actual_config.fleet_labels_len == -1) {
+      fprintf(stderr, "ERROR: The Prometheus labels are too long to be "
+                      "pushed to the fleet aggregator: the max length "
+                      "allowable is %d.\n", FLEET_FRAME_MAX_LABELS_LEN);
+      exit(20);
+    }
+    actual_config.fleet_push_fd = net_connect_udp(actual_config.fleet_target);
+    if (actual_config.fleet_push_fd == -1) {
+      exit(21);
+    }
+  }
+
+  if (actual_config.udp_target != NULL) {
+    // the UDP publisher allocates its datagram buffers once, here, and it
+    // is used for the whole life of the process
+    actual_config.udp_publisher =
+          udp_publisher_create(actual_config.udp_target,
+                               actual_config.udp_format,
+                               actual_config.udp_batch_samples,
+                               actual_config.prometheus_labels,
+                               actual_config.num_prometheus_labels);
+    if (actual_config.udp_publisher == NULL) {
+      exit(18);
+    }
+  }
+
+  if (actual_config.metrics_listen != NULL ||
+      actual_config.trigger_socket != NULL) {
+    if (actual_config.freshness_ttl_seconds == 0)
+      actual_config.freshness_ttl_seconds = actual_config.wait_seconds;
+    run_on_demand_sampler(&actual_config, &handover);
+    exit(23);
+  }
+
+  do_main_loop(&actual_config, &handover);
+  return 0;
 }
@@ -0,0 +1,110 @@
+// The configuration of the sampler, and the functions of its sampling and
+// publication, for the harnesses in Simulated/ that link them against the
+// simulated sensor (with the sampler's main() renamed).
+#ifndef RASPPI_DHT22_SAMPLER_H
+#define RASPPI_DHT22_SAMPLER_H
+
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "udp_publisher.h"
+
+// Some defaults
+// The first one is a default GPIO index (for the mapping of GPIO indexes to
+// physical pin numbers see, e.g.,
+// https://www.raspberrypi.org/forums/viewtopic.php?t=196696 )
+#ifdef PI_2_MMIO_FIXED_GPIO
+// built for a single GPIO index ('make PIN=...'): it can't be changed with '-g'
+#define DEFAULT_DHT_GPIO_IDX  PI_2_MMIO_FIXED_GPIO
+#else
+#define DEFAULT_DHT_GPIO_IDX  17
+#endif
+#define DEFAULT_WAIT_SECONDS  60
+#define DEFAULT_UDP_BATCH_SAMPLES  1
+
+#define PROMETHEUS_TEXT_COLL_FILE  "dht22.prom"
+#define PROMETHEUS_TEXT_COLL_DIR  "/var/lib/node_exporter/textfile_collector"
+
+// The time taken by the synchronous writes of the textfile
+struct textfile_timings {
+  unsigned long long writes;
+  double seconds_total;
+};
+
+// The type specifying the configuration settings for this program
+struct configuration_settings {
+  int dht22_gpio_idx;
+  bool temperature_in_farenheit;
+  int wait_seconds;
+  char text_collector_fname[PATH_MAX+1];
+  char ** prometheus_labels;
+  int num_prometheus_labels;
+  const char * udp_target;          // "host:port", or NULL for no UDP output
+  enum udp_output_format udp_format;
+  int udp_batch_samples;
+  struct udp_publisher * udp_publisher;
+  const char * fleet_target;        // aggregator to push the samples to
+  int fleet_push_fd;
+  char * fleet_labels;              // the labels, joined once for the frames
+  int fleet_labels_len;
+  const char * aggregator_listen;   // run as a fleet aggregator instead
+  const char * metrics_listen;      // on-demand mode: serve /metrics here...
+  const char * trigger_socket;      // ... and/or take triggers on this socket
+  int freshness_ttl_seconds;        // max age of a sample served on-demand
+  float change_threshold;           // adaptive mode, if greater than 0
+  int republish_seconds;            // adaptive mode: max time between writes
+  const char * arbiter_name;        // share the capture windows with others
+  struct capture_arbiter * arbiter;
+  bool textfile_fsync;              // fsync() the textfile before its rename
+  bool textfile_uring;              // write the textfile through io_uring...
+  struct textfile_ring * textfile_ring;   // ... if it is available
+  struct textfile_timings * textfile_timings;
+};
+
+// The state of the adaptive mode ('-c change_threshold')
+struct adaptive_cadence {
+  int period_seconds;
+  bool have_sample;                 // the last sample read...
+  float temperature;
+  float relative_humidity;
+  bool have_published;              // ... and the last one written
+  float published_temperature;
+  float published_humidity;
+  int published_period_seconds;
+  unsigned long long published_at_usec;   // CLOCK_MONOTONIC
+};
+
+int convert_str_to_int(const char * str);
+float convert_str_to_float(const char * str);
+
+void parse_command_line(int argc, char *const *argv,
+                        struct configuration_settings * output_config);
+
+void dht22_values_to_prometheus(FILE *output,
+                                float dht22_temp, float dht22_humidity,
+                                const struct configuration_settings * config);
+
+// Write the textfile synchronously...
+void write_textfile(float temperature, float relative_humidity,
+                    int sampling_period_seconds,
+                    const struct configuration_settings * config);
+
+// ... or queue it in the io_uring ring of "config" (false if it can't be)
+bool queue_textfile_write(float temperature, float relative_humidity,
+                          int sampling_period_seconds,
+                          const struct configuration_settings * config);
+
+// Publish a sample to all the outputs of "config"
+void publish_dht22_sample(float temperature, float relative_humidity,
+                          int sampling_period_seconds,
+                          const struct configuration_settings * config);
+
+void sample_dht22_sensor_to_prometheus(
+                   const struct configuration_settings * config);
+
+// Take a sample in the adaptive mode, and return the period until the next.
+int sample_adaptively(struct adaptive_cadence * cadence,
+                      const struct configuration_settings * config);
+
+#endif
@@ -0,0 +1,450 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "textfile_ring.h"
+
+// The requests of the chain of each file, in order (the low byte of their
+// user_data; the slot is in the rest)
+enum chain_op { OP_OPENAT, OP_WRITE, OP_FSYNC, OP_CLOSE, OP_RENAMEAT };
+static const char * const op_names[] = { "openat", "write", "fsync", "close",
+                                         "renameat" };
+#define CHAIN_MAX_OPS  5
+#define RING_ENTRIES   (TEXTFILE_RING_SLOTS * CHAIN_MAX_OPS)
+
+enum slot_state { SLOT_FREE, SLOT_QUEUED, SLOT_IN_FLIGHT };
+
+struct ring_slot {
+  enum slot_state state;
+  int pending_ops;              // the completions still to reap
+  int failed_op;                // the first request that failed, or -1
+  int failed_res;
+  size_t len;
+  unsigned long long submitted_ns;
+  char fname[PATH_MAX+1];
+  char temp_fname[PATH_MAX+1];
+};
+
+struct textfile_ring {
+  int ring_fd;
+  bool with_fsync;
+  bool broken;                  // after an error of io_uring_enter()
+  unsigned long long temp_token;   // random, in the temporary file names
+  // the rings, as mapped from the kernel (their indexes are only kept
+  // there: a child forked while the ring is idle, e.g. that of the
+  // benchmark, can use it, and the parent after it)
+  void * rings;
+  size_t rings_size;
+  struct io_uring_sqe * sqes;
+  size_t sqes_size;
+  unsigned * sq_head;
+  unsigned * sq_tail;
+  unsigned * sq_mask;
+  unsigned * cq_head;
+  unsigned * cq_tail;
+  unsigned * cq_mask;
+  struct io_uring_cqe * cqes;
+  // the registered buffers, a shared mapping: it must not be copied on a
+  // fork(), as the kernel keeps writing from the pages registered
+  char * buffers;
+  int curr_slot;                // the slot of the last buffer returned
+  int in_flight;
+  unsigned long long completed;
+  unsigned long long latency_ns;
+  unsigned long long enters;
+  struct ring_slot slots[TEXTFILE_RING_SLOTS];
+};
+
+static void report_errno(const char * preffix_msg) {
+  int old_errno = errno;
+  char err_msg[256];
+  strerror_r(old_errno, err_msg, sizeof err_msg);
+  fprintf(stderr, "%s: %d: %s\n", preffix_msg, old_errno, err_msg);
+}
+
+static unsigned long long monotonic_ns(void) {
+  struct timespec curr_time;
+  clock_gettime(CLOCK_MONOTONIC, &curr_time);
+  return (unsigned long long)curr_time.tv_sec * 1000000000 +
+         curr_time.tv_nsec;
+}
+
+// (glibc has no wrappers of the io_uring system calls)
+static int sys_io_uring_setup(unsigned entries,
+                              struct io_uring_params * params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int ring_fd, unsigned to_submit,
+                              unsigned min_complete, unsigned flags) {
+  return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+                 flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int ring_fd, unsigned opcode,
+                                 const void * arg, unsigned nr_args) {
+  return syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+static bool supports_chain_ops(int ring_fd) {
+
+  const int probe_ops = 256;
+  struct io_uring_probe * probe =
+        calloc(1, sizeof *probe + probe_ops * sizeof probe->ops[0]);
+  if (probe == NULL ||
+      sys_io_uring_register(ring_fd, IORING_REGISTER_PROBE, probe,
+                            probe_ops) == -1) {
+    free(probe);
+    return false;
+  }
+  const int needed_ops[] = { IORING_OP_OPENAT, IORING_OP_WRITE_FIXED,
+                             IORING_OP_FSYNC, IORING_OP_CLOSE,
+                             IORING_OP_RENAMEAT };
+  bool supported = true;
+  for (int i = 0; i < sizeof needed_ops / sizeof needed_ops[0]; i++)
+    if (needed_ops[i] > probe->last_op ||
+        ! (probe->ops[needed_ops[i]].flags & IO_URING_OP_SUPPORTED))
+      supported = false;
+  free(probe);
+  return supported;
+}
+
+static int map_rings(struct textfile_ring * ring,
+                     const struct io_uring_params * params) {
+
+  // (a single mapping for both rings: Linux 5.4 or later)
+  size_t sq_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+  size_t cq_size = params->cq_off.cqes +
+                   params->cq_entries * sizeof(struct io_uring_cqe);
+  ring->rings_size = sq_size > cq_size ? sq_size : cq_size;
+  ring->rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+                     IORING_OFF_SQ_RING);
+  if (ring->rings == MAP_FAILED) {
+    ring->rings = NULL;
+    return -1;
+  }
+  ring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    return -1;
+  }
+
+  char * rings = ring->rings;
+  ring->sq_head = (unsigned *)(rings + params->sq_off.head);
+  ring->sq_tail = (unsigned *)(rings + params->sq_off.tail);
+  ring->sq_mask = (unsigned *)(rings + params->sq_off.ring_mask);
+  ring->cq_head = (unsigned *)(rings + params->cq_off.head);
+  ring->cq_tail = (unsigned *)(rings + params->cq_off.tail);
+  ring->cq_mask = (unsigned *)(rings + params->cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(rings + params->cq_off.cqes);
+  // each SQE is always at its own index of the array
+  unsigned * sq_array = (unsigned *)(rings + params->sq_off.array);
+  for (unsigned i = 0; i < params->sq_entries; i++)
+    sq_array[i] = i;
+  return 0;
+}
+
+static int register_resources(struct textfile_ring * ring) {
+
+  ring->buffers = mmap(NULL, TEXTFILE_RING_SLOTS * TEXTFILE_RING_BUFFER_SIZE,
+                       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                       -1, 0);
+  if (ring->buffers == MAP_FAILED) {
+    ring->buffers = NULL;
+    return -1;
+  }
+  struct iovec iovecs[TEXTFILE_RING_SLOTS];
+  for (int slot = 0; slot < TEXTFILE_RING_SLOTS; slot++) {
+    iovecs[slot].iov_base = ring->buffers + slot * TEXTFILE_RING_BUFFER_SIZE;
+    iovecs[slot].iov_len = TEXTFILE_RING_BUFFER_SIZE;
+  }
+  if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_BUFFERS, iovecs,
+                            TEXTFILE_RING_SLOTS) == -1)
+    return -1;
+
+  // a sparse table of direct descriptors, one per slot, for the files
+  // opened by the chains (Linux 5.19 or later)
+  struct io_uring_rsrc_register files = { .nr = TEXTFILE_RING_SLOTS,
+                                          .flags =
+                                            IORING_RSRC_REGISTER_SPARSE };
+  return sys_io_uring_register(ring->ring_fd, IORING_REGISTER_FILES2, &files,
+                               sizeof files);
+}
+
+struct textfile_ring * textfile_ring_create(bool with_fsync) {
+
+  struct textfile_ring * ring = calloc(1, sizeof *ring);
+  if (ring == NULL)
+    return NULL;
+  ring->with_fsync = with_fsync;
+  if (getrandom(&ring->temp_token, sizeof ring->temp_token,
+                GRND_NONBLOCK) != sizeof ring->temp_token)
+    ring->temp_token = monotonic_ns() ^ (unsigned long long)getpid() << 32;
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof params);
+  // (SUBMIT_ALL: a request that fails to be prepared doesn't stop the
+  // submission of the rest)
+  params.flags = IORING_SETUP_SUBMIT_ALL;
+  ring->ring_fd = sys_io_uring_setup(RING_ENTRIES, &params);
+  if (ring->ring_fd == -1) {
+    report_errno("WARNING: io_uring is not available: io_uring_setup()");
+    free(ring);
+    return NULL;
+  }
+
+  const char * failure = NULL;
+  if (! (params.features & IORING_FEAT_SINGLE_MMAP))
+    failure = "this kernel's io_uring is too old";
+  else if (map_rings(ring, &params) == -1)
+    failure = "could not map its rings";
+  else if (! supports_chain_ops(ring->ring_fd))
+    failure = "this kernel's io_uring lacks openat, renameat or close";
+  else if (register_resources(ring) == -1)
+    failure = "could not register its buffers or its direct descriptors";
+  if (failure != NULL) {
+    fprintf(stderr, "WARNING: io_uring is not available: %s.\n", failure);
+    textfile_ring_destroy(ring);
+    return NULL;
+  }
+  return ring;
+}
+
+void textfile_ring_destroy(struct textfile_ring * ring) {
+  // (closing the ring cancels the requests still in flight)
+  close(ring->ring_fd);
+  if (ring->rings != NULL)
+    munmap(ring->rings, ring->rings_size);
+  if (ring->sqes != NULL)
+    munmap(ring->sqes, ring->sqes_size);
+  if (ring->buffers != NULL)
+    munmap(ring->buffers, TEXTFILE_RING_SLOTS * TEXTFILE_RING_BUFFER_SIZE);
+  free(ring);
+}
+
+int textfile_ring_fd(const struct textfile_ring * ring) {
+  return ring->ring_fd;
+}
+
+char * textfile_ring_buffer(struct textfile_ring * ring) {
+
+  if (ring->broken)
+    return NULL;
+  for (int pass = 0; pass < 2; pass++) {
+    for (int slot = 0; slot < TEXTFILE_RING_SLOTS; slot++)
+      if (ring->slots[slot].state == SLOT_FREE) {
+        ring->curr_slot = slot;
+        return ring->buffers + slot * TEXTFILE_RING_BUFFER_SIZE;
+      }
+    textfile_ring_reap(ring);     // (some may have completed meanwhile)
+  }
+  return NULL;
+}
+
+static struct io_uring_sqe * next_sqe(struct textfile_ring * ring, int slot,
+                                      enum chain_op op, uint8_t opcode,
+                                      uint8_t flags) {
+  // (without SQPOLL, the kernel only reads the SQEs in io_uring_enter(): so
+  // the tail can be moved before the SQE is filled)
+  unsigned tail = *ring->sq_tail;
+  struct io_uring_sqe * sqe = &ring->sqes[tail & *ring->sq_mask];
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  memset(sqe, 0, sizeof *sqe);
+  sqe->opcode = opcode;
+  sqe->flags = flags;
+  sqe->user_data = (uint64_t)slot << 8 | op;
+  return sqe;
+}
+
+int textfile_ring_queue(struct textfile_ring * ring, const char * fname,
+                        size_t len) {
+
+  int slot_idx = ring->curr_slot;
+  struct ring_slot * slot = &ring->slots[slot_idx];
+  if (snprintf(slot->fname, sizeof slot->fname, "%s", fname) >=
+        (int)sizeof slot->fname ||
+      snprintf(slot->temp_fname, sizeof slot->temp_fname, "%s.%016llx.%d",
+               fname, ring->temp_token, slot_idx) >=
+        (int)sizeof slot->temp_fname) {
+    return -1;
+  }
+
+  // The chains of the same file must rename in the order they were queued:
+  // if another one is queued or in flight, this one is only started after
+  // all the requests submitted before it complete.
+  uint8_t drain = 0;
+  for (int other = 0; other < TEXTFILE_RING_SLOTS; other++)
+    if (other != slot_idx && ring->slots[other].state != SLOT_FREE &&
+        strcmp(ring->slots[other].fname, slot->fname) == 0)
+      drain = IOSQE_IO_DRAIN;
+
+  slot->state = SLOT_QUEUED;
+  slot->len = len;
+  slot->failed_op = -1;
+  slot->pending_ops = ring->with_fsync ? 5 : 4;
+
+  // Each request runs only if the previous one succeeded (a short write
+  // fails too): if any fails, the final file is left as it was.
+  struct io_uring_sqe * sqe;
+  sqe = next_sqe(ring, slot_idx, OP_OPENAT, IORING_OP_OPENAT,
+                 IOSQE_IO_LINK | drain);
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uintptr_t)slot->temp_fname;
+  // (as mkstemp(): never an existing file, nor through a symbolic link)
+  sqe->open_flags = O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW;
+  sqe->len = 0600;
+  sqe->file_index = slot_idx + 1;     // into the direct descriptor slot_idx
+
+  sqe = next_sqe(ring, slot_idx, OP_WRITE, IORING_OP_WRITE_FIXED,
+                 IOSQE_FIXED_FILE | IOSQE_IO_LINK);
+  sqe->fd = slot_idx;
+  sqe->addr = (uintptr_t)(ring->buffers + slot_idx * TEXTFILE_RING_BUFFER_SIZE);
+  sqe->len = len;
+  sqe->off = 0;
+  sqe->buf_index = slot_idx;
+
+  if (ring->with_fsync) {
+    sqe = next_sqe(ring, slot_idx, OP_FSYNC, IORING_OP_FSYNC,
+                   IOSQE_FIXED_FILE | IOSQE_IO_LINK);
+    sqe->fd = slot_idx;
+  }
+
+  sqe = next_sqe(ring, slot_idx, OP_CLOSE, IORING_OP_CLOSE, IOSQE_IO_LINK);
+  sqe->file_index = slot_idx + 1;
+
+  sqe = next_sqe(ring, slot_idx, OP_RENAMEAT, IORING_OP_RENAMEAT, 0);
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uintptr_t)slot->temp_fname;
+  sqe->len = AT_FDCWD;
+  sqe->addr2 = (uintptr_t)slot->fname;
+  return 0;
+}
+
+int textfile_ring_submit(struct textfile_ring * ring) {
+
+  unsigned to_submit = *ring->sq_tail -
+                       __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  if (to_submit == 0)
+    return 0;
+
+  unsigned long long now = monotonic_ns();
+  for (int slot = 0; slot < TEXTFILE_RING_SLOTS; slot++)
+    if (ring->slots[slot].state == SLOT_QUEUED) {
+      ring->slots[slot].state = SLOT_IN_FLIGHT;
+      ring->slots[slot].submitted_ns = now;
+      ring->in_flight++;
+    }
+
+  while (to_submit > 0) {
+    int submitted = sys_io_uring_enter(ring->ring_fd, to_submit, 0, 0);
+    ring->enters++;
+    if (submitted == -1) {
+      if (errno == EINTR)
+        continue;
+      report_errno("WARNING: Could not submit the textfile to io_uring");
+      ring->broken = true;
+      return -1;
+    }
+    to_submit -= submitted;
+  }
+  return 0;
+}
+
+static void complete_slot(struct textfile_ring * ring,
+                          struct ring_slot * slot) {
+
+  ring->completed++;
+  ring->latency_ns += monotonic_ns() - slot->submitted_ns;
+  ring->in_flight--;
+  slot->state = SLOT_FREE;
+  if (slot->failed_op == -1)
+    return;
+
+  if (slot->failed_res < 0) {
+    char err_msg[256];
+    strerror_r(-slot->failed_res, err_msg, sizeof err_msg);
+    fprintf(stderr, "WARNING: Could not write '%s' through io_uring: %s(): "
+                    "%d: %s\n", slot->fname, op_names[slot->failed_op],
+                    -slot->failed_res, err_msg);
+  } else {
+    fprintf(stderr, "WARNING: Could not write '%s' through io_uring: "
+                    "wrote %d of %zu bytes\n", slot->fname,
+                    slot->failed_res, slot->len);
+  }
+  if (slot->failed_op != OP_OPENAT)
+    unlink(slot->temp_fname);
+}
+
+int textfile_ring_reap(struct textfile_ring * ring) {
+
+  int completed = 0;
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+  for (; head != tail; head++) {
+    const struct io_uring_cqe * cqe = &ring->cqes[head & *ring->cq_mask];
+    struct ring_slot * slot = &ring->slots[cqe->user_data >> 8];
+    enum chain_op op = cqe->user_data & 0xff;
+
+    // (the requests after a failed one complete with -ECANCELED)
+    bool failed = (cqe->res < 0 && cqe->res != -ECANCELED) ||
+                  (op == OP_WRITE && cqe->res >= 0 &&
+                   (size_t)cqe->res != slot->len);
+    if (failed && slot->failed_op == -1) {
+      slot->failed_op = op;
+      slot->failed_res = cqe->res;
+    }
+    if (--slot->pending_ops == 0) {
+      complete_slot(ring, slot);
+      completed++;
+    }
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  return completed;
+}
+
+void textfile_ring_wait(struct textfile_ring * ring) {
+
+  textfile_ring_reap(ring);
+  while (ring->in_flight > 0 && ! ring->broken) {
+    // all the completions still to come, at once
+    unsigned pending_ops = 0;
+    for (int slot = 0; slot < TEXTFILE_RING_SLOTS; slot++)
+      if (ring->slots[slot].state == SLOT_IN_FLIGHT)
+        pending_ops += ring->slots[slot].pending_ops;
+    int result = sys_io_uring_enter(ring->ring_fd, 0, pending_ops,
+                                    IORING_ENTER_GETEVENTS);
+    ring->enters++;
+    if (result == -1 && errno != EINTR) {
+      report_errno("WARNING: Could not wait for io_uring");
+      return;
+    }
+    textfile_ring_reap(ring);
+  }
+}
+
+unsigned long long textfile_ring_completed(const struct textfile_ring * ring) {
+  return ring->completed;
+}
+
+double textfile_ring_latency_seconds(const struct textfile_ring * ring) {
+  return ring->latency_ns / 1e9;
+}
+
+unsigned long long textfile_ring_enters(const struct textfile_ring * ring) {
+  return ring->enters;
+}
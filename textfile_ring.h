@@ -0,0 +1,65 @@
+// Publisher of Prometheus' text-collector files through io_uring(7), for the
+// sensors sampled at a high frequency: instead of the blocking mkstemp(),
+// write(), close() and rename() of each file, the files of a tick are
+// written by one submission of linked requests,
+//
+//     openat -> write -> [fsync ->] close -> renameat
+//
+// one such chain per file, into a temporary file opened as a direct (fixed)
+// descriptor, and from a buffer registered with the ring, into which the
+// caller renders the contents. The completions are reaped asynchronously,
+// from the ring's shared memory, when its file descriptor is readable.
+//
+// It uses the raw system calls, and the direct descriptors of Linux 5.19 or
+// later: textfile_ring_create() fails on older kernels, or when io_uring is
+// disabled, and the caller writes the files synchronously instead.
+#ifndef TEXTFILE_RING_H
+#define TEXTFILE_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// files in flight at once (e.g., those of a tick of that many sensors)
+#define TEXTFILE_RING_SLOTS        8
+#define TEXTFILE_RING_BUFFER_SIZE  16384
+
+struct textfile_ring;
+
+// Set up the ring, and register its buffers and its direct descriptors.
+// Returns NULL (after printing the reason) if io_uring is not available.
+struct textfile_ring * textfile_ring_create(bool with_fsync);
+
+void textfile_ring_destroy(struct textfile_ring * ring);
+
+// The file descriptor to poll for completions (readable when there are some)
+int textfile_ring_fd(const struct textfile_ring * ring);
+
+// The registered buffer of a free slot, to render the next file into, or
+// NULL if all the slots are in flight.
+char * textfile_ring_buffer(struct textfile_ring * ring);
+
+// Queue the writing of "len" bytes of the buffer last returned by
+// textfile_ring_buffer() to the file "fname". The writes of the same file
+// are renamed into place in the order they were queued. Returns -1 if
+// "fname" is too long.
+int textfile_ring_queue(struct textfile_ring * ring, const char * fname,
+                        size_t len);
+
+// Submit the files queued, with a single io_uring_enter(). Returns -1 on
+// error, in which case the ring is not usable anymore.
+int textfile_ring_submit(struct textfile_ring * ring);
+
+// Reap the completions available, without a system call, and report the
+// files that couldn't be written. Returns the files completed.
+int textfile_ring_reap(struct textfile_ring * ring);
+
+// Wait until all the files submitted are completed (e.g., before exiting).
+void textfile_ring_wait(struct textfile_ring * ring);
+
+// The files completed, their total time from the submission to the
+// completion, and the io_uring_enter() calls made
+unsigned long long textfile_ring_completed(const struct textfile_ring * ring);
+double textfile_ring_latency_seconds(const struct textfile_ring * ring);
+unsigned long long textfile_ring_enters(const struct textfile_ring * ring);
+
+#endif
@@ -0,0 +1,217 @@
+#define _GNU_SOURCE     // for sendmmsg()
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "net_sockets.h"
+#include "udp_publisher.h"
+
+struct udp_publisher {
+  int sock_fd;
+  enum udp_output_format format;
+  int batch_samples;            // samples to coalesce before sending
+  int pending_samples;
+  // the Prometheus labels, converted once to ",tag=value" pairs
+  char tags[UDP_PUBLISHER_MAX_TAGS_LEN];
+  int curr_datagram;
+  size_t lengths[UDP_PUBLISHER_MAX_DATAGRAMS];
+  char datagrams[UDP_PUBLISHER_MAX_DATAGRAMS][UDP_PUBLISHER_DATAGRAM_SIZE];
+  struct iovec iovecs[UDP_PUBLISHER_MAX_DATAGRAMS];
+  struct mmsghdr messages[UDP_PUBLISHER_MAX_DATAGRAMS];
+};
+
+int udp_publisher_parse_format(const char * name,
+                               enum udp_output_format * format) {
+  if (strcmp(name, "influx") == 0) {
+    *format = UDP_FORMAT_INFLUX;
+  } else if (strcmp(name, "statsd") == 0) {
+    *format = UDP_FORMAT_STATSD;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+static int append_tag(char * tags, size_t * tags_len, const char * label,
+                      enum udp_output_format format) {
+  // label is a validated 'label_name="label_value"' pair
+  const char * equal_separator = strchr(label, '=');
+  const char * value = equal_separator + 1;
+  size_t value_len = strlen(value);
+  if (value_len >= 2 && value[0] == '"' && value[value_len - 1] == '"') {
+    value++;
+    value_len -= 2;
+  }
+
+  size_t len = *tags_len;
+  size_t name_len = equal_separator - label;
+  if (len + 1 + name_len + 1 >= UDP_PUBLISHER_MAX_TAGS_LEN)
+    return -1;
+  tags[len++] = ',';
+  memcpy(tags + len, label, name_len);
+  len += name_len;
+  tags[len++] = '=';
+
+  for (size_t i = 0; i < value_len; i++) {
+    char c = value[i];
+    if (len + 2 >= UDP_PUBLISHER_MAX_TAGS_LEN)
+      return -1;
+    if (format == UDP_FORMAT_INFLUX) {
+      // the line protocol requires escaping these in tag values
+      if (c == ' ' || c == ',' || c == '=')
+        tags[len++] = '\\';
+    } else if (c == ':' || c == '|' || c == ',' || c == '=' || c == ' ') {
+      // StatsD has no escaping: these would break the metric line
+      c = '_';
+    }
+    tags[len++] = c;
+  }
+  tags[len] = '\0';
+  *tags_len = len;
+  return 0;
+}
+
+struct udp_publisher * udp_publisher_create(const char * target,
+                                            enum udp_output_format format,
+                                            int batch_samples,
+                                            char * const * prometheus_labels,
+                                            int num_prometheus_labels) {
+
+  struct udp_publisher * publisher = calloc(1, sizeof *publisher);
+  if (publisher == NULL) {
+    fprintf(stderr, "ERROR: while allocating memory for the UDP datagrams\n");
+    return NULL;
+  }
+  publisher->format = format;
+  publisher->batch_samples = batch_samples > 0 ? batch_samples : 1;
+
+  size_t tags_len = 0;
+  for (int label_idx = 0; label_idx < num_prometheus_labels; label_idx++) {
+    if (append_tag(publisher->tags, &tags_len, prometheus_labels[label_idx],
+                   format) != 0) {
+      fprintf(stderr, "ERROR: The Prometheus labels are too long to be sent "
+                      "as tags: the max length allowable is %d.\n",
+                      UDP_PUBLISHER_MAX_TAGS_LEN - 1);
+      free(publisher);
+      return NULL;
+    }
+  }
+
+  for (int i = 0; i < UDP_PUBLISHER_MAX_DATAGRAMS; i++) {
+    publisher->iovecs[i].iov_base = publisher->datagrams[i];
+    publisher->messages[i].msg_hdr.msg_iov = &publisher->iovecs[i];
+    publisher->messages[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  publisher->sock_fd = net_connect_udp(target);
+  if (publisher->sock_fd == -1) {
+    free(publisher);
+    return NULL;
+  }
+  return publisher;
+}
+
+static int encode_sample(const struct udp_publisher * publisher,
+                         char * buf, size_t space,
+                         const char * temperature_metric_name,
+                         float temperature, float relative_humidity,
+                         unsigned long long epoch_nanosec) {
+  const char * tags = publisher->tags;
+  int len;
+
+  if (publisher->format == UDP_FORMAT_INFLUX) {
+    // one point with both fields, named as the Prometheus metrics without
+    // their "dht22_" prefix
+    len = snprintf(buf, space,
+                   "dht22%s relat_humidity=%.2f,%s=%.2f %llu\n",
+                   tags, relative_humidity,
+                   temperature_metric_name + strlen("dht22_"), temperature,
+                   epoch_nanosec);
+  } else {
+    // a StatsD gauge with a leading sign is a relative change: a negative
+    // temperature needs to be sent as a reset to 0 followed by the decrement
+    const char * format = (temperature < 0) ?
+                            "dht22_relat_humidity%1$s:%2$.2f|g\n"
+                            "%3$s%1$s:0|g\n"
+                            "%3$s%1$s:%4$.2f|g\n"
+                          :
+                            "dht22_relat_humidity%1$s:%2$.2f|g\n"
+                            "%3$s%1$s:%4$.2f|g\n";
+    len = snprintf(buf, space, format, tags, relative_humidity,
+                   temperature_metric_name, temperature);
+  }
+  return (len < 0 || len >= space) ? -1 : len;
+}
+
+void udp_publisher_add_sample(struct udp_publisher * publisher,
+                              const char * temperature_metric_name,
+                              float temperature, float relative_humidity,
+                              unsigned long long epoch_nanosec) {
+
+  int curr = publisher->curr_datagram;
+  size_t used = publisher->lengths[curr];
+  int len = encode_sample(publisher, publisher->datagrams[curr] + used,
+                          UDP_PUBLISHER_DATAGRAM_SIZE - used,
+                          temperature_metric_name, temperature,
+                          relative_humidity, epoch_nanosec);
+  if (len == -1 && used > 0) {
+    // doesn't fit in what is left of this datagram: start the next one,
+    // sending the batch first if there is no next one
+    if (curr + 1 == UDP_PUBLISHER_MAX_DATAGRAMS)
+      udp_publisher_flush(publisher);
+    else
+      publisher->curr_datagram++;
+    curr = publisher->curr_datagram;
+    len = encode_sample(publisher, publisher->datagrams[curr],
+                        UDP_PUBLISHER_DATAGRAM_SIZE,
+                        temperature_metric_name, temperature,
+                        relative_humidity, epoch_nanosec);
+  }
+  if (len == -1) {
+    fprintf(stderr, "WARNING: A sample doesn't fit in a UDP datagram of %d "
+                    "bytes. Discarding it.\n", UDP_PUBLISHER_DATAGRAM_SIZE);
+    return;
+  }
+  publisher->lengths[curr] += len;
+
+  if (++publisher->pending_samples >= publisher->batch_samples)
+    udp_publisher_flush(publisher);
+}
+
+void udp_publisher_flush(struct udp_publisher * publisher) {
+
+  int num_datagrams = publisher->curr_datagram + 1;
+  if (publisher->lengths[publisher->curr_datagram] == 0)
+    num_datagrams--;
+
+  for (int i = 0; i < num_datagrams; i++)
+    publisher->iovecs[i].iov_len = publisher->lengths[i];
+
+  int sent = 0;
+  while (sent < num_datagrams) {
+    // never let a slow network stall the sampling loop
+    int result = sendmmsg(publisher->sock_fd, publisher->messages + sent,
+                          num_datagrams - sent, MSG_DONTWAIT);
+    if (result == -1) {
+      if (errno == EINTR)
+        continue;
+      int old_errno = errno;
+      char err_buf[256];
+      const char * err_msg = strerror_r(old_errno, err_buf, sizeof err_buf);
+      fprintf(stderr, "WARNING: Could not send %d UDP datagrams: %d: %s\n",
+              num_datagrams - sent, old_errno, err_msg);
+      break;
+    }
+    sent += result;
+  }
+
+  for (int i = 0; i < UDP_PUBLISHER_MAX_DATAGRAMS; i++)
+    publisher->lengths[i] = 0;
+  publisher->curr_datagram = 0;
+  publisher->pending_samples = 0;
+}
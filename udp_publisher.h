@@ -0,0 +1,49 @@
+// Batched publisher of the DHT22 samples over UDP, in InfluxDB line protocol
+// or in StatsD gauges, e.g. to feed Telegraf's socket_listener or statsd
+// inputs alongside the Prometheus' text-collector file.
+//
+// Samples are encoded into preallocated datagrams of at most
+// UDP_PUBLISHER_DATAGRAM_SIZE bytes (a sample is never split between two
+// datagrams), and the datagrams of a batch are sent together with a single
+// sendmmsg().
+#ifndef UDP_PUBLISHER_H
+#define UDP_PUBLISHER_H
+
+// An IPv6 datagram with this payload fits in a 1500 bytes Ethernet MTU
+#define UDP_PUBLISHER_DATAGRAM_SIZE   1432
+#define UDP_PUBLISHER_MAX_DATAGRAMS   8
+#define UDP_PUBLISHER_MAX_TAGS_LEN    1024
+
+enum udp_output_format {
+  UDP_FORMAT_INFLUX,    // dht22,tag=value relat_humidity=..,temperature_..=.. ts
+  UDP_FORMAT_STATSD     // dht22_relat_humidity,tag=value:22.40|g
+};
+
+struct udp_publisher;
+
+// Parse the "udp_output_format" name ("influx" or "statsd"). Returns -1 if
+// it is not a known format.
+int udp_publisher_parse_format(const char * name,
+                               enum udp_output_format * format);
+
+// Allocate a publisher with all its datagram buffers, open its UDP socket to
+// "target" ("host:port", or "[ipv6_address]:port"), and convert the
+// Prometheus 'label_name="label_value"' pairs to tags. Returns NULL (after
+// printing the reason) on error.
+struct udp_publisher * udp_publisher_create(const char * target,
+                                            enum udp_output_format format,
+                                            int batch_samples,
+                                            char * const * prometheus_labels,
+                                            int num_prometheus_labels);
+
+// Encode a sample into the current batch, and send the batch if it has
+// "batch_samples" samples or if its datagrams are full.
+void udp_publisher_add_sample(struct udp_publisher * publisher,
+                              const char * temperature_metric_name,
+                              float temperature, float relative_humidity,
+                              unsigned long long epoch_nanosec);
+
+// Send the samples pending in the current batch, if any.
+void udp_publisher_flush(struct udp_publisher * publisher);
+
+#endif